@@ -0,0 +1,593 @@
+// TP1_11_buffered_output.c
+
+/*
+    Changes from the previous code:
+
+    - Added an output buffer collecting the shell's own messages (status line, prompt, diagnostics) until the next flush.
+    - Added the `flushOutput` function, writing each buffer with a single `writev` before forking, before exec, before reading input and at exit.
+    - Modified the `writeStatusMessage` function to format into the growable buffer instead of a fixed 100-byte array.
+    - Added the `writeDiagnostic` function for the shell's own error messages on the standard error.
+    - Added the `fatalError` function, flushing pending output before `perror` and `exit`.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_INPUT_SIZE 100
+#define MAX_ARGS 10
+#define MAX_OUTPUT_SEGMENTS 64
+
+// Wait status of a process that exited normally with the given code
+#define EXIT_STATUS(code) (((code) & 0xff) << 8)
+
+// Interactive mode (welcome message, prompt and exit message)
+static int interactiveMode = 1;
+
+// Output buffer: literal messages are queued by reference, formatted ones are copied into `data`
+typedef struct {
+    int fd;
+    char *data;
+    size_t length;
+    size_t capacity;
+    struct {
+        const char *message; // Literal message, or NULL for a formatted one stored in `data`
+        size_t offset;
+        size_t length;
+    } segments[MAX_OUTPUT_SEGMENTS];
+    size_t segmentCount;
+} OutputBuffer;
+
+static OutputBuffer standardOutput = { .fd = STDOUT_FILENO };
+static OutputBuffer standardError = { .fd = STDERR_FILENO };
+
+// Output Buffer
+void appendOutput(OutputBuffer *buffer, const char *message, size_t length, int copy);
+void appendFormattedOutput(OutputBuffer *buffer, const char *format, va_list arguments);
+void flushOutputBuffer(OutputBuffer *buffer);
+void flushOutput(void);
+void fatalError(const char *message);
+
+// Helper Functions
+void writeMessage(const char *message);
+void writeFormattedMessage(const char *format, ...);
+void writeDiagnostic(const char *format, ...);
+void writeStatusMessage(char *command, int status, long executionTime);
+
+// Read Input
+ssize_t readPrompt(char *input, size_t size);
+
+// Process Input
+void processUserInput(char *input, ssize_t bytesRead, int *status, long *executionTime);
+void executeCommand(char *input, int *status);
+void runCommand(char *input);
+void tokenizeInput(char *input, char *args[], size_t *argCount);
+void handleRedirection(char *args[], size_t argCount);
+void handlePipe(char *args[], size_t argCount);
+
+// Builtins
+int isExecBuiltin(const char *input);
+void execBuiltin(char *input, int *status);
+
+// Command String Mode
+void runCommandString(char *input);
+
+// Display Status
+void displayPromptStatus(int status, long executionTime);
+
+
+
+// -------------------- Output Buffer -------------------- //
+void appendOutput(OutputBuffer *buffer, const char *message, size_t length, int copy) {
+    // Flush when the segment table is full
+    if (buffer->segmentCount == MAX_OUTPUT_SEGMENTS) {
+        flushOutputBuffer(buffer);
+    }
+
+    // Copy the message into the buffer, growing it when needed
+    size_t offset = buffer->length;
+    if (copy) {
+        if (buffer->length + length > buffer->capacity) {
+            size_t capacity = buffer->capacity ? buffer->capacity : 256;
+            while (capacity < buffer->length + length) {
+                capacity *= 2;
+            }
+            char *data = realloc(buffer->data, capacity);
+            if (data == NULL) {
+                fatalError("Error: appendOutput\nrealloc");
+            }
+            buffer->data = data;
+            buffer->capacity = capacity;
+        }
+        memcpy(buffer->data + buffer->length, message, length);
+        buffer->length += length;
+    }
+
+    // Record the segment (the address of a copied message is resolved at flush time)
+    buffer->segments[buffer->segmentCount].message = copy ? NULL : message;
+    buffer->segments[buffer->segmentCount].offset = offset;
+    buffer->segments[buffer->segmentCount].length = length;
+    buffer->segmentCount++;
+}
+
+void appendFormattedOutput(OutputBuffer *buffer, const char *format, va_list arguments) {
+    // Measure the formatted message first so that it is never truncated
+    va_list copy;
+    va_copy(copy, arguments);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (length < 0) {
+        return;
+    }
+
+    // Format on the stack when the message is short, otherwise on the heap
+    char small[256];
+    char *message = (size_t) length < sizeof(small) ? small : malloc((size_t) length + 1);
+    if (message == NULL) {
+        fatalError("Error: appendFormattedOutput\nmalloc");
+    }
+    vsnprintf(message, (size_t) length + 1, format, arguments);
+    appendOutput(buffer, message, (size_t) length, 1);
+    if (message != small) {
+        free(message);
+    }
+}
+
+void flushOutputBuffer(OutputBuffer *buffer) {
+    struct iovec iov[MAX_OUTPUT_SEGMENTS];
+    int iovCount = 0;
+
+    // Gather the segments, merging formatted messages that are contiguous in the buffer
+    for (size_t i = 0; i < buffer->segmentCount; i++) {
+        const char *base = buffer->segments[i].message;
+        if (base == NULL) {
+            base = buffer->data + buffer->segments[i].offset;
+            if (iovCount > 0 && (char *) iov[iovCount - 1].iov_base + iov[iovCount - 1].iov_len == base) {
+                iov[iovCount - 1].iov_len += buffer->segments[i].length;
+                continue;
+            }
+        }
+        iov[iovCount].iov_base = (void *) base;
+        iov[iovCount].iov_len = buffer->segments[i].length;
+        iovCount++;
+    }
+    buffer->segmentCount = 0;
+    buffer->length = 0;
+
+    // Write everything with one writev, resuming after partial writes
+    struct iovec *current = iov;
+    while (iovCount > 0) {
+        ssize_t written = writev(buffer->fd, current, iovCount);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (iovCount > 0 && (size_t) written >= current->iov_len) {
+            written -= (ssize_t) current->iov_len;
+            current++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            current->iov_base = (char *) current->iov_base + written;
+            current->iov_len -= (size_t) written;
+        }
+    }
+}
+
+void flushOutput(void) {
+    // Diagnostics first, so that they appear before the next prompt
+    flushOutputBuffer(&standardError);
+    flushOutputBuffer(&standardOutput);
+}
+
+void fatalError(const char *message) {
+    // Flush pending output without losing the error number reported by perror
+    int savedErrno = errno;
+    flushOutput();
+    errno = savedErrno;
+
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+
+
+// -------------------- Helper Functions -------------------- //
+void writeMessage(const char *message) {
+    // Queue the message for the standard output (literal messages are not copied)
+    appendOutput(&standardOutput, message, strlen(message), 0);
+}
+
+void writeFormattedMessage(const char *format, ...) {
+    // Queue a formatted message for the standard output
+    va_list arguments;
+    va_start(arguments, format);
+    appendFormattedOutput(&standardOutput, format, arguments);
+    va_end(arguments);
+}
+
+void writeDiagnostic(const char *format, ...) {
+    // Queue a formatted message for the standard error
+    va_list arguments;
+    va_start(arguments, format);
+    appendFormattedOutput(&standardError, format, arguments);
+    va_end(arguments);
+}
+
+void writeStatusMessage(char *command, int status, long executionTime) {
+    // Create a prompt message with the specified command, status and execution time
+    writeFormattedMessage("enseash [%s:%d|%ldms] %% ", command, status, executionTime);
+}
+
+
+
+// --------------------- Read Input --------------------- //
+ssize_t readPrompt(char *input, size_t size) {
+    // Flush the prompt before blocking on input
+    flushOutput();
+
+    // Read input from standard input
+    ssize_t bytesRead = read(STDIN_FILENO, input, size);
+
+    // Check for errors during input reading
+    if (bytesRead < 0) {
+        fatalError("Error: readPrompt\nread");
+    }
+
+    // Remove trailing newline character (\n)
+    if (bytesRead > 0) {
+        input[bytesRead - 1] = '\0';
+    }
+
+    // Return the number of bytes read
+    return bytesRead;
+}
+
+
+
+// --------------------- Process Input --------------------- //
+void processUserInput(char *input, ssize_t bytesRead, int *status, long *executionTime) {
+    // Exit the shell with 'exit' command or Ctrl+D
+    if (strcmp(input, "exit") == 0 || bytesRead == 0) {
+        if (interactiveMode) {
+            if (bytesRead == 0) {
+                writeMessage("\n");
+            }
+            writeMessage("Exiting ENSEA Shell.\n");
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    // Replace the shell with 'exec' command
+    else if (isExecBuiltin(input)) {
+        execBuiltin(input, status);
+        *executionTime = 0;
+    }
+
+    // User command
+    else {
+        // Initialize timestamps (time.h)
+        struct timespec start_time, end_time;
+
+        // Get start time
+        if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+            fatalError("Error: processUserInput (Start Time)\nclock_gettime");
+        }
+
+        // Execute the user command and wait for completion
+        executeCommand(input, status);
+
+        // Get the end time
+        if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+            fatalError("Error: processUserInput (End Time)\nclock_gettime");
+        }
+
+        // Calculate the execution time in milliseconds
+        long seconds = end_time.tv_sec - start_time.tv_sec;
+        long nanoseconds = end_time.tv_nsec - start_time.tv_nsec;
+        *executionTime = seconds * 1000 + nanoseconds / 1000000;
+    }
+}
+
+void executeCommand(char *input, int *status) {
+    // Flush pending output so that the child does not inherit it
+    flushOutput();
+
+    // Create a child process
+    pid_t pid = fork();
+
+    // Check for errors
+    if (pid == -1) {
+        fatalError("Error: executeCommand\nfork");
+    }
+
+    // Parent process
+    else if (pid != 0) {
+        // Parent waits for the child process
+        wait(status);
+    }
+
+    // Child process
+    else {
+        runCommand(input);
+    }
+}
+
+void runCommand(char *input) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+
+    // Tokenize the input into command and arguments
+    tokenizeInput(input, args, &argCount);
+
+    // Handle commands with input and output redirection
+    handleRedirection(args, argCount);
+
+    // Handle commands with pipe
+    handlePipe(args, argCount);
+
+    // Execute the command using execvp
+    execvp(args[0], args);
+
+    // If execvp fails, print an error message
+    fatalError("Error: executeCommand\nexecvp");
+}
+
+void tokenizeInput(char *input, char *args[], size_t *argCount) {
+    // Use strtok to split the string into tokens (words) using space as the delimiter
+    char *token = strtok(input, " ");
+    while (token != NULL && *argCount < MAX_ARGS) {
+        args[(*argCount)++] = token;
+        token = strtok(NULL, " ");
+    }
+
+    // Set the last element of the args array to NULL as required by execvp
+    args[*argCount] = NULL;
+}
+
+void handleRedirection(char *args[], size_t argCount) {
+    // File for input and output redirection
+    char *inputFile = NULL;
+    char *outputFile = NULL;
+
+    // Iterate through the arguments to check for input and output redirection
+    for (size_t i = 0; i < argCount; i++) {
+        // Input redirection
+        if (strcmp(args[i], "<") == 0) {
+            inputFile = args[i + 1];
+            args[i] = NULL; // Remove '<' from the argument list
+        }
+
+        // Output redirection
+        else if (strcmp(args[i], ">") == 0) {
+            outputFile = args[i + 1];
+            args[i] = NULL; // Remove '>' from the argument list
+        }
+    }
+
+    // Handle input redirection
+    if (inputFile != NULL) {
+        // Open the input file for reading
+        int fd = open(inputFile, O_RDONLY);
+        if (fd == -1) {
+            fatalError("Error: handleRedirection (Input)\nopen");
+        }
+
+        // Redirect standard input to the file
+        if (dup2(fd, STDIN_FILENO) == -1) {
+            perror("Error: handleRedirection (Input)\ndup2");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    // Handle output redirection
+    if (outputFile != NULL) {
+        // Open the output file for writing
+        int fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd == -1) {
+            fatalError("Error: handleRedirection (Output)\nopen");
+        }
+
+        // Redirect standard output to the file
+        if (dup2(fd, STDOUT_FILENO) == -1) {
+            perror("Error: handleRedirection (Output)\ndup2");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+}
+
+void handlePipe(char *args[], size_t argCount) {
+    // Iterate through the arguments to check for pipe redirection
+    for (size_t i = 0; i < argCount; i++) {
+        if (args[i] != NULL && strcmp(args[i], "|") == 0) {
+            // Set the pipe symbol to NULL to separate the first and second command
+            args[i] = NULL;
+
+            // Split the arguments into two parts
+            char **firstCommand = &args[0];
+            char **secondCommand = &args[i + 1];
+
+            // Check for errors
+            int pipefd[2];
+            if (pipe(pipefd) == -1) {
+                fatalError("Error: handlePipe\npipe");
+            }
+
+            pid_t childPid = fork();
+            if (childPid == -1) {
+                fatalError("Error: handlePipe\nfork");
+            }
+
+            // Parent process: Execute the first command before the pipe
+            else if (childPid != 0) {
+                // Close the read end of the pipe since the parent writes to it
+                close(pipefd[0]);
+
+                // Redirect standard output to the write end of the pipe
+                if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
+                    perror("Error: handlePipe (firstCommand)\ndup2");
+                    close(pipefd[1]);
+                    exit(EXIT_FAILURE);
+                }
+
+                // Close the write end of the pipe as it's no longer needed
+                close(pipefd[1]);
+
+                // Execute the first command using execvp
+                execvp(firstCommand[0], firstCommand);
+
+                // If execvp fails, print an error message
+                fatalError("Error: handlePipe (firstCommand)\nexecvp");
+            }
+
+            // Child process: Execute the second command after the pipe
+            else {
+                // Close the write end of the pipe since the child reads from it
+                close(pipefd[1]);
+
+                // Redirect standard input to the read end of the pipe
+                if (dup2(pipefd[0], STDIN_FILENO) == -1) {
+                    perror("Error: handlePipe (secondCommand)\ndup2");
+                    close(pipefd[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                // Close the read end of the pipe as it's no longer needed
+                close(pipefd[0]);
+
+                // Execute the second command using execvp
+                execvp(secondCommand[0], secondCommand);
+
+                // If execvp fails, print an error message
+                fatalError("Error: handlePipe (secondCommand)\nexecvp");
+            }
+        }
+    }
+}
+
+
+
+// --------------------- Builtins --------------------- //
+int isExecBuiltin(const char *input) {
+    // Match the 'exec' word alone or followed by a space
+    return strncmp(input, "exec", 4) == 0 && (input[4] == '\0' || input[4] == ' ');
+}
+
+void execBuiltin(char *input, int *status) {
+    // Skip the 'exec' word and the spaces after it
+    char *command = input + 4;
+    while (*command == ' ') {
+        command++;
+    }
+
+    // Without a command, 'exec' does nothing
+    if (*command == '\0') {
+        *status = EXIT_STATUS(EXIT_SUCCESS);
+        return;
+    }
+
+    // Replace the shell with the command (does not return)
+    flushOutput();
+    runCommand(command);
+}
+
+
+
+// --------------------- Command String Mode --------------------- //
+void runCommandString(char *input) {
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+    long executionTime;
+
+    // Skip leading spaces
+    while (*input == ' ') {
+        input++;
+    }
+
+    // An empty command string succeeds without doing anything
+    if (*input == '\0') {
+        exit(EXIT_SUCCESS);
+    }
+
+    // Builtins run in the shell process
+    if (strcmp(input, "exit") == 0 || isExecBuiltin(input)) {
+        processUserInput(input, (ssize_t) strlen(input) + 1, &status, &executionTime);
+        exit(WEXITSTATUS(status));
+    }
+
+    // The last command is external: replace the shell instead of forking and waiting
+    flushOutput();
+    runCommand(input);
+}
+
+
+
+// --------------------- Display Status --------------------- //
+void displayPromptStatus(int status, long executionTime) {
+    // Check if the command was successful
+    if (WIFEXITED(status)) {
+        // If the command exited normally, display exit status in the prompt
+        writeStatusMessage("exit", WEXITSTATUS(status), executionTime);
+    } else if (WIFSIGNALED(status)) {
+        // If the command was terminated by a signal, display signal information in the prompt
+        writeStatusMessage("sign", WTERMSIG(status), executionTime);
+    }
+}
+
+
+
+// --------------------- Main --------------------- //
+int main(int argc, char *argv[]) {
+    // Flush pending output whenever the shell exits
+    atexit(flushOutput);
+
+    // Command string mode: run the command without welcome message or prompt
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            writeDiagnostic("enseash: -c: option requires an argument\n");
+            exit(2);
+        }
+        interactiveMode = 0;
+        runCommandString(argv[2]);
+    }
+
+    char input[MAX_INPUT_SIZE];
+    int status;
+    long executionTime;
+
+    // Display the welcome message at launch
+    writeMessage("Welcome to ENSEA Shell.\nType 'exit' or press 'Ctrl+D' to quit.\n");
+
+    // Display the shell prompt
+    writeMessage("enseash % ");
+
+    // Main loop
+    while (1) {
+        // Read user input
+        ssize_t bytesRead = readPrompt(input, sizeof(input));
+
+        // Process user input and execute the command
+        processUserInput(input, bytesRead, &status, &executionTime);
+
+        // Display prompt status
+        displayPromptStatus(status, executionTime);
+    }
+
+    exit(EXIT_SUCCESS);
+}
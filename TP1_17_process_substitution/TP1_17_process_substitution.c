@@ -0,0 +1,1870 @@
+// TP1_17_process_substitution.c
+
+/*
+    Changes from the previous code:
+
+    - Added process substitution: `<(cmd)` and `>(cmd)` are replaced by `/dev/fd/N` paths to pipes connected to commands running concurrently with the outer command.
+    - Added the `executeProcessSubstitutions` function: the shell starts the inner commands, reaps and times every participant and reports the status and time of each inner command.
+    - Split the `executeCommand` function into `startCommand` and `waitCommand`, which now waits for its own child with `waitpid`.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create and file sealing
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#define MAX_INPUT_SIZE 100
+#define MAX_ARGS 10
+#define MAX_OUTPUT_SEGMENTS 64
+#define MAX_COMMAND_NAME 32
+#define MAX_LIST_ELEMENTS 32
+#define MAX_HERE_DOCUMENTS 16
+#define MAX_SUBSTITUTIONS 8
+
+// Latency histogram: values below 16us are exact, above each power of two is split in 16 buckets
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAGNITUDES 37 // Up to 2^40us (about 12 days)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_COUNT)
+
+// Wait status of a process that exited normally with the given code
+#define EXIT_STATUS(code) (((code) & 0xff) << 8)
+
+// Exit code of the shell for the wait status of its last command
+#define EXIT_CODE(status) (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status))
+
+// Operator linking a command of a list to the previous one
+typedef enum {
+    LIST_SEQUENCE, // ';'
+    LIST_AND,      // '&&'
+    LIST_OR        // '||'
+} ListOperator;
+
+// Command of a list, with the operator written before it
+typedef struct {
+    char *command;
+    ListOperator operator;
+} ListElement;
+
+// Interactive mode (welcome message, prompt and exit message)
+static int interactiveMode = 1;
+
+// Output buffer: literal messages are queued by reference, formatted ones are copied into `data`
+typedef struct {
+    int fd;
+    char *data;
+    size_t length;
+    size_t capacity;
+    struct {
+        const char *message; // Literal message, or NULL for a formatted one stored in `data`
+        size_t offset;
+        size_t length;
+    } segments[MAX_OUTPUT_SEGMENTS];
+    size_t segmentCount;
+} OutputBuffer;
+
+static OutputBuffer standardOutput = { .fd = STDOUT_FILENO };
+static OutputBuffer standardError = { .fd = STDERR_FILENO };
+
+// Performance counter opened on each child when the performance mode is enabled
+typedef struct {
+    const char *name;        // Short name displayed in the status line
+    const char *description; // Name displayed by the 'perfstat' builtin
+    uint32_t type;
+    uint64_t config;
+    int hardware;
+    int fd;
+    int available;           // Counter could be opened for the last command
+    uint64_t value;          // Value scaled by the multiplexing ratio
+} PerfCounter;
+
+#ifdef __linux__
+static PerfCounter perfCounters[] = {
+    { "ins",  "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,   1, -1, 0, 0 },
+    { "cyc",  "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,     1, -1, 0, 0 },
+    { "cmis", "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,   1, -1, 0, 0 },
+    { "bmis", "branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,  1, -1, 0, 0 },
+    { "task", "task-clock",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,     0, -1, 0, 0 },
+    { "pf",   "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,    0, -1, 0, 0 },
+    { "cs",   "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0, -1, 0, 0 },
+};
+#define PERF_COUNTER_COUNT (sizeof(perfCounters) / sizeof(perfCounters[0]))
+#endif
+
+// Performance mode (enabled by 'perfstat on'), validity of the counters of the last command
+// and whether they still have to be displayed in the status line
+static int perfMode = 0;
+static int perfCountersValid = 0;
+static int perfCountersPending = 0;
+
+// Here-document body, found by the address of its '<<' token in the input (children share it after fork)
+typedef struct {
+    const char *operator;
+    char *body;
+    size_t length;
+    size_t capacity;
+} HereDocument;
+
+static HereDocument hereDocuments[MAX_HERE_DOCUMENTS];
+static size_t hereDocumentCount = 0;
+
+// Inner command of a process substitution, connected to the outer command by a pipe
+typedef struct {
+    char direction; // '<' when the outer command reads the output, '>' when it writes the input
+    char *command;
+    pid_t pid;
+    int fd;         // End of the pipe passed to the outer command as /dev/fd/N
+    int status;
+    struct timespec start;
+    struct timespec end;
+} Substitution;
+
+// Latency statistics of the commands with the same name
+typedef struct {
+    char name[MAX_COMMAND_NAME];
+    uint64_t count;
+    uint64_t failures;
+    uint64_t maxMicroseconds;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} CommandStats;
+
+static CommandStats *commandStats = NULL;
+static size_t commandStatsCount = 0;
+static size_t commandStatsCapacity = 0;
+static pid_t statsOwner;
+
+// Output Buffer
+void appendOutput(OutputBuffer *buffer, const char *message, size_t length, int copy);
+void appendFormattedOutput(OutputBuffer *buffer, const char *format, va_list arguments);
+void flushOutputBuffer(OutputBuffer *buffer);
+void flushOutput(void);
+void fatalError(const char *message);
+
+// Helper Functions
+void writeMessage(const char *message);
+void writeFormattedMessage(const char *format, ...);
+void writeDiagnostic(const char *format, ...);
+void writeStatusMessage(char *command, int status, long executionTime);
+void writeScaledValue(uint64_t value);
+
+// Read Input
+ssize_t readPrompt(char *input, size_t size);
+
+// Process Input
+void processUserInput(char *input, ssize_t bytesRead, int *status, long *executionTime);
+int parseCommandList(char *input, ListElement elements[], size_t *elementCount);
+int groupDelimiter(const char *input, const char *c);
+char *splitGroup(char *command, char **redirections);
+int checkGroupRedirections(char *args[], size_t argCount);
+void executeBraceGroup(char *command, int *status, int tailCall);
+void runSubshell(char *command);
+void executeCommandList(char *input, int *status, int tailCall);
+void executeListElement(char *command, int *status, int tailCall);
+uint64_t elapsedMicroseconds(const struct timespec *start, const struct timespec *end);
+void executeCommand(char *input, int *status);
+pid_t startCommand(char *input);
+void waitCommand(pid_t pid, int *status);
+int hasProcessSubstitution(const char *command);
+void executeProcessSubstitutions(char *command, int *status);
+void runCommand(char *input);
+void tokenizeInput(char *input, char *args[], size_t *argCount);
+int handleRedirection(char *args[], size_t argCount);
+int createInlineFile(const char *data, size_t length, int newline);
+void handlePipe(char *args[], size_t argCount);
+
+// Here-Documents
+int collectHereDocuments(char *input);
+void appendHereDocument(HereDocument *document, const char *data, size_t length);
+int readHereDocument(HereDocument *document, const char *delimiter, size_t delimiterLength);
+const HereDocument *findHereDocument(const char *operator);
+void clearHereDocuments(void);
+
+// Performance Counters
+void openPerfCounters(pid_t pid);
+void readPerfCounters(void);
+
+// Latency Statistics
+size_t histogramIndex(uint64_t value);
+uint64_t histogramValue(size_t index);
+uint64_t histogramPercentile(const CommandStats *stats, double percentile);
+void recordCommandStats(const char *input, int status, uint64_t microseconds);
+void writeDuration(uint64_t microseconds);
+void writeStatsTable(const char *format);
+void dumpStats(void);
+
+// Builtins
+int isBuiltin(const char *input, const char *name);
+void exitShell(int code);
+void exitBuiltin(char *input, int *status);
+void execBuiltin(char *input, int *status);
+void perfstatBuiltin(char *input, int *status);
+void statsBuiltin(char *input, int *status);
+
+// Command String Mode
+void runCommandString(char *input);
+
+// Display Status
+void displayPromptStatus(int status, long executionTime);
+
+
+
+// -------------------- Output Buffer -------------------- //
+void appendOutput(OutputBuffer *buffer, const char *message, size_t length, int copy) {
+    // Flush when the segment table is full
+    if (buffer->segmentCount == MAX_OUTPUT_SEGMENTS) {
+        flushOutputBuffer(buffer);
+    }
+
+    // Copy the message into the buffer, growing it when needed
+    size_t offset = buffer->length;
+    if (copy) {
+        if (buffer->length + length > buffer->capacity) {
+            size_t capacity = buffer->capacity ? buffer->capacity : 256;
+            while (capacity < buffer->length + length) {
+                capacity *= 2;
+            }
+            char *data = realloc(buffer->data, capacity);
+            if (data == NULL) {
+                fatalError("Error: appendOutput\nrealloc");
+            }
+            buffer->data = data;
+            buffer->capacity = capacity;
+        }
+        memcpy(buffer->data + buffer->length, message, length);
+        buffer->length += length;
+    }
+
+    // Record the segment (the address of a copied message is resolved at flush time)
+    buffer->segments[buffer->segmentCount].message = copy ? NULL : message;
+    buffer->segments[buffer->segmentCount].offset = offset;
+    buffer->segments[buffer->segmentCount].length = length;
+    buffer->segmentCount++;
+}
+
+void appendFormattedOutput(OutputBuffer *buffer, const char *format, va_list arguments) {
+    // Measure the formatted message first so that it is never truncated
+    va_list copy;
+    va_copy(copy, arguments);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (length < 0) {
+        return;
+    }
+
+    // Format on the stack when the message is short, otherwise on the heap
+    char small[256];
+    char *message = (size_t) length < sizeof(small) ? small : malloc((size_t) length + 1);
+    if (message == NULL) {
+        fatalError("Error: appendFormattedOutput\nmalloc");
+    }
+    vsnprintf(message, (size_t) length + 1, format, arguments);
+    appendOutput(buffer, message, (size_t) length, 1);
+    if (message != small) {
+        free(message);
+    }
+}
+
+void flushOutputBuffer(OutputBuffer *buffer) {
+    struct iovec iov[MAX_OUTPUT_SEGMENTS];
+    int iovCount = 0;
+
+    // Gather the segments, merging formatted messages that are contiguous in the buffer
+    for (size_t i = 0; i < buffer->segmentCount; i++) {
+        const char *base = buffer->segments[i].message;
+        if (base == NULL) {
+            base = buffer->data + buffer->segments[i].offset;
+            if (iovCount > 0 && (char *) iov[iovCount - 1].iov_base + iov[iovCount - 1].iov_len == base) {
+                iov[iovCount - 1].iov_len += buffer->segments[i].length;
+                continue;
+            }
+        }
+        iov[iovCount].iov_base = (void *) base;
+        iov[iovCount].iov_len = buffer->segments[i].length;
+        iovCount++;
+    }
+    buffer->segmentCount = 0;
+    buffer->length = 0;
+
+    // Write everything with one writev, resuming after partial writes
+    struct iovec *current = iov;
+    while (iovCount > 0) {
+        ssize_t written = writev(buffer->fd, current, iovCount);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (iovCount > 0 && (size_t) written >= current->iov_len) {
+            written -= (ssize_t) current->iov_len;
+            current++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            current->iov_base = (char *) current->iov_base + written;
+            current->iov_len -= (size_t) written;
+        }
+    }
+}
+
+void flushOutput(void) {
+    // Diagnostics first, so that they appear before the next prompt
+    flushOutputBuffer(&standardError);
+    flushOutputBuffer(&standardOutput);
+}
+
+void fatalError(const char *message) {
+    // Flush pending output without losing the error number reported by perror
+    int savedErrno = errno;
+    flushOutput();
+    errno = savedErrno;
+
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+
+
+// -------------------- Helper Functions -------------------- //
+void writeMessage(const char *message) {
+    // Queue the message for the standard output (literal messages are not copied)
+    appendOutput(&standardOutput, message, strlen(message), 0);
+}
+
+void writeFormattedMessage(const char *format, ...) {
+    // Queue a formatted message for the standard output
+    va_list arguments;
+    va_start(arguments, format);
+    appendFormattedOutput(&standardOutput, format, arguments);
+    va_end(arguments);
+}
+
+void writeDiagnostic(const char *format, ...) {
+    // Queue a formatted message for the standard error
+    va_list arguments;
+    va_start(arguments, format);
+    appendFormattedOutput(&standardError, format, arguments);
+    va_end(arguments);
+}
+
+void writeStatusMessage(char *command, int status, long executionTime) {
+    // Create a prompt message with the specified command, status and execution time
+    writeFormattedMessage("enseash [%s:%d|%ldms", command, status, executionTime);
+
+#ifdef __linux__
+    // Extend the prompt with the counters of the last command (hardware ones when permitted)
+    if (perfMode && perfCountersValid && perfCountersPending) {
+        perfCountersPending = 0;
+        int hardware = perfCounters[0].available;
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (perfCounters[i].available && perfCounters[i].hardware == hardware) {
+                writeFormattedMessage("|%s:", perfCounters[i].name);
+                if (perfCounters[i].config == PERF_COUNT_SW_TASK_CLOCK && perfCounters[i].type == PERF_TYPE_SOFTWARE) {
+                    writeFormattedMessage("%.1fms", (double) perfCounters[i].value / 1e6);
+                } else {
+                    writeScaledValue(perfCounters[i].value);
+                }
+            }
+        }
+    }
+#endif
+
+    writeMessage("] % ");
+}
+
+void writeScaledValue(uint64_t value) {
+    // Write a counter value with a K/M/G suffix
+    if (value >= 1000000000ULL) {
+        writeFormattedMessage("%.1fG", (double) value / 1e9);
+    } else if (value >= 1000000ULL) {
+        writeFormattedMessage("%.1fM", (double) value / 1e6);
+    } else if (value >= 1000ULL) {
+        writeFormattedMessage("%.1fK", (double) value / 1e3);
+    } else {
+        writeFormattedMessage("%llu", (unsigned long long) value);
+    }
+}
+
+
+
+// --------------------- Read Input --------------------- //
+ssize_t readPrompt(char *input, size_t size) {
+    // Flush the prompt before blocking on input
+    flushOutput();
+
+    // Read input from standard input
+    ssize_t bytesRead = read(STDIN_FILENO, input, size);
+
+    // Check for errors during input reading
+    if (bytesRead < 0) {
+        fatalError("Error: readPrompt\nread");
+    }
+
+    // Remove trailing newline character (\n)
+    if (bytesRead > 0) {
+        input[bytesRead - 1] = '\0';
+    }
+
+    // Return the number of bytes read
+    return bytesRead;
+}
+
+
+
+// --------------------- Process Input --------------------- //
+void processUserInput(char *input, ssize_t bytesRead, int *status, long *executionTime) {
+    // Exit the shell with Ctrl+D
+    if (bytesRead == 0) {
+        if (interactiveMode) {
+            writeMessage("\n");
+        }
+        exitShell(EXIT_CODE(*status));
+    }
+
+    // Initialize timestamps (time.h)
+    struct timespec start_time, end_time;
+
+    // Get start time
+    if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+        fatalError("Error: processUserInput (Start Time)\nclock_gettime");
+    }
+
+    // Execute the user command list and wait for completion
+    if (collectHereDocuments(input) == -1) {
+        *status = EXIT_STATUS(2);
+    } else {
+        executeCommandList(input, status, 0);
+    }
+
+    // Get the end time
+    if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+        fatalError("Error: processUserInput (End Time)\nclock_gettime");
+    }
+
+    // Calculate the execution time of the whole list in milliseconds
+    *executionTime = (long) (elapsedMicroseconds(&start_time, &end_time) / 1000);
+}
+
+int parseCommandList(char *input, ListElement elements[], size_t *elementCount) {
+    static const char *operatorNames[] = { ";", "&&", "||" };
+    ListOperator operator = LIST_SEQUENCE;
+    char *start = input;
+    int depth = 0;
+    *elementCount = 0;
+
+    for (char *c = input; ; c++) {
+        int atEnd = *c == '\0';
+
+        // List operators inside a group belong to the group
+        int delimiter = atEnd ? 0 : groupDelimiter(input, c);
+        depth += delimiter;
+        if (depth < 0) {
+            writeDiagnostic("enseash: syntax error near '%c'\n", *c);
+            return -1;
+        }
+        if (atEnd && depth > 0) {
+            writeDiagnostic("enseash: syntax error: unterminated group\n");
+            return -1;
+        }
+        if (delimiter != 0 || (depth > 0 && !atEnd)) {
+            continue;
+        }
+
+        // Find the end of the current command: end of input, newline or list operator
+        ListOperator next = LIST_SEQUENCE;
+        size_t length = 1;
+        int atNewline = *c == '\n';
+        if (atEnd || atNewline || *c == ';') {
+            next = LIST_SEQUENCE;
+        } else if (c[0] == '&' && c[1] == '&') {
+            next = LIST_AND;
+            length = 2;
+        } else if (c[0] == '|' && c[1] == '|') {
+            next = LIST_OR;
+            length = 2;
+        } else {
+            continue;
+        }
+
+        // Terminate the command and trim its spaces
+        *c = '\0';
+        while (*start == ' ') {
+            start++;
+        }
+        for (char *end = c; end > start && end[-1] == ' '; end--) {
+            end[-1] = '\0';
+        }
+
+        // Empty lines are skipped (a list operator continues on the next line)
+        if (*start == '\0' && atNewline) {
+            start = c + 1;
+            continue;
+        }
+
+        // An empty command is only allowed at the end of the input, after ';'
+        if (*start == '\0') {
+            if (atEnd && operator == LIST_SEQUENCE) {
+                return 0;
+            }
+            writeDiagnostic("enseash: syntax error near '%s'\n", atEnd ? operatorNames[operator] : operatorNames[next]);
+            return -1;
+        }
+        if (*elementCount == MAX_LIST_ELEMENTS) {
+            writeDiagnostic("enseash: too many commands in the list (maximum %d)\n", MAX_LIST_ELEMENTS);
+            return -1;
+        }
+        elements[*elementCount].command = start;
+        elements[*elementCount].operator = operator;
+        (*elementCount)++;
+
+        if (atEnd) {
+            return 0;
+        }
+
+        // The next command starts after the operator
+        operator = next;
+        c += length - 1;
+        start = c + 1;
+    }
+}
+
+int groupDelimiter(const char *input, const char *c) {
+    // Parentheses always delimit a subshell
+    if (*c == '(') {
+        return 1;
+    }
+    if (*c == ')') {
+        return -1;
+    }
+
+    // Braces only delimit a group when they are separate words
+    if (*c != '{' && *c != '}') {
+        return 0;
+    }
+    int wordStart = c == input || strchr(" \n;&|(", c[-1]) != NULL;
+    int wordEnd = strchr(" \n;)", c[1]) != NULL;
+    if (!wordStart || !wordEnd) {
+        return 0;
+    }
+    return *c == '{' ? 1 : -1;
+}
+
+char *splitGroup(char *command, char **redirections) {
+    // Find the delimiter closing the group that starts the command
+    char closer = *command == '(' ? ')' : '}';
+    int depth = 0;
+    for (char *c = command; *c != '\0'; c++) {
+        depth += groupDelimiter(command, c);
+        if (depth == 0) {
+            if (*c != closer) {
+                break;
+            }
+
+            // The group is followed by its redirections
+            *c = '\0';
+            *redirections = c + 1;
+            return command + 1;
+        }
+    }
+
+    writeDiagnostic("enseash: syntax error: unterminated group\n");
+    return NULL;
+}
+
+int checkGroupRedirections(char *args[], size_t argCount) {
+    // Only redirections ('< file', '> file', '<<EOF', '<<< word') may follow a group
+    for (size_t i = 0; i < argCount; i++) {
+        int operator = strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0 || strcmp(args[i], "<<") == 0 ||
+                       strcmp(args[i], "<<<") == 0;
+        if ((!operator && strncmp(args[i], "<<", 2) != 0) || (operator && i + 1 == argCount)) {
+            writeDiagnostic("enseash: syntax error near '%s' after a group\n", args[i]);
+            return -1;
+        }
+        if (operator) {
+            i++;
+        }
+    }
+    return 0;
+}
+
+void executeBraceGroup(char *command, int *status, int tailCall) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+    char *redirections;
+
+    // Split the group and its redirections
+    char *inner = splitGroup(command, &redirections);
+    if (inner != NULL) {
+        tokenizeInput(redirections, args, &argCount);
+    }
+    if (inner == NULL || checkGroupRedirections(args, argCount) == -1) {
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    // Without redirections, the group is just a list
+    if (argCount == 0) {
+        executeCommandList(inner, status, tailCall);
+        return;
+    }
+
+    // Save the standard input and output once for the whole group
+    flushOutput();
+    int savedInput = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    int savedOutput = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (savedInput == -1 || savedOutput == -1) {
+        fatalError("Error: executeBraceGroup\nfcntl");
+    }
+
+    // Run the list with the redirections of the group
+    if (handleRedirection(args, argCount) == -1) {
+        *status = EXIT_STATUS(EXIT_FAILURE);
+    } else {
+        executeCommandList(inner, status, tailCall);
+    }
+
+    // Write the shell's own output to the redirected descriptors, then restore them
+    flushOutput();
+    if (dup2(savedInput, STDIN_FILENO) == -1 || dup2(savedOutput, STDOUT_FILENO) == -1) {
+        fatalError("Error: executeBraceGroup\ndup2");
+    }
+    close(savedInput);
+    close(savedOutput);
+}
+
+void runSubshell(char *command) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+    char *redirections;
+
+    // Split the group and its redirections
+    char *inner = splitGroup(command, &redirections);
+    if (inner != NULL) {
+        tokenizeInput(redirections, args, &argCount);
+    }
+    if (inner == NULL || checkGroupRedirections(args, argCount) == -1) {
+        flushOutput();
+        exit(2);
+    }
+
+    // Handle the redirections of the group
+    if (handleRedirection(args, argCount) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Run the list like a command string: its last command replaces this process
+    interactiveMode = 0;
+    runCommandString(inner);
+}
+
+void executeCommandList(char *input, int *status, int tailCall) {
+    ListElement elements[MAX_LIST_ELEMENTS];
+    size_t elementCount;
+
+    // Split the input into commands
+    if (parseCommandList(input, elements, &elementCount) == -1) {
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    for (size_t i = 0; i < elementCount; i++) {
+        // '&&' and '||' decide from the status of the last command that ran
+        int succeeded = WIFEXITED(*status) && WEXITSTATUS(*status) == 0;
+        if ((elements[i].operator == LIST_AND && !succeeded) || (elements[i].operator == LIST_OR && succeeded)) {
+            continue;
+        }
+
+        // In command string mode, the last command replaces the shell
+        executeListElement(elements[i].command, status, tailCall && i == elementCount - 1);
+    }
+}
+
+void executeListElement(char *command, int *status, int tailCall) {
+    // Exit the shell with 'exit' command
+    if (isBuiltin(command, "exit")) {
+        exitBuiltin(command, status);
+    }
+
+    // Replace the shell with 'exec' command
+    else if (isBuiltin(command, "exec")) {
+        execBuiltin(command, status);
+    }
+
+    // Enable, disable or display the performance counters with 'perfstat' command
+    else if (isBuiltin(command, "perfstat")) {
+        perfstatBuiltin(command, status);
+    }
+
+    // Display the latency statistics with 'stats' command
+    else if (isBuiltin(command, "stats")) {
+        statsBuiltin(command, status);
+    }
+
+    // Brace group: run in the shell process
+    else if (groupDelimiter(command, command) == 1 && *command == '{') {
+        executeBraceGroup(command, status, tailCall);
+    }
+
+    // Last external command of a command string: replace the shell instead of forking and waiting
+    // (not with process substitutions, whose commands are reaped by the shell)
+    else if (tailCall && !hasProcessSubstitution(command)) {
+        flushOutput();
+        runCommand(command);
+    }
+
+    // External command: direct child of the shell
+    else {
+        struct timespec start_time, end_time;
+
+        if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+            fatalError("Error: executeListElement (Start Time)\nclock_gettime");
+        }
+
+        // Execute the command and wait for completion
+        if (hasProcessSubstitution(command)) {
+            executeProcessSubstitutions(command, status);
+        } else {
+            executeCommand(command, status);
+        }
+
+        if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+            fatalError("Error: executeListElement (End Time)\nclock_gettime");
+        }
+
+        // Record the execution time in the histogram of the command (the parent's input is not tokenized)
+        if (*command != '(') {
+            recordCommandStats(command, *status, elapsedMicroseconds(&start_time, &end_time));
+        }
+    }
+}
+
+uint64_t elapsedMicroseconds(const struct timespec *start, const struct timespec *end) {
+    // Difference between two timestamps in microseconds
+    long seconds = end->tv_sec - start->tv_sec;
+    long nanoseconds = end->tv_nsec - start->tv_nsec;
+    return (uint64_t) (seconds * 1000000 + nanoseconds / 1000);
+}
+
+void executeCommand(char *input, int *status) {
+    // Create the child process and wait for its completion
+    pid_t pid = startCommand(input);
+    waitCommand(pid, status);
+}
+
+pid_t startCommand(char *input) {
+    // Flush pending output so that the child does not inherit it
+    flushOutput();
+
+    // In performance mode, the child waits on this pipe until its counters are opened
+    int syncfd[2] = { -1, -1 };
+    if (perfMode && pipe(syncfd) == -1) {
+        fatalError("Error: startCommand\npipe");
+    }
+
+    // Create a child process
+    pid_t pid = fork();
+
+    // Check for errors
+    if (pid == -1) {
+        fatalError("Error: startCommand\nfork");
+    }
+
+    // Parent process
+    else if (pid != 0) {
+        // Open the counters on the child, then release it
+        if (perfMode) {
+            close(syncfd[0]);
+            openPerfCounters(pid);
+            close(syncfd[1]);
+        }
+    }
+
+    // Child process
+    else {
+        // Wait until the parent has opened the counters (end of file on the pipe)
+        if (perfMode) {
+            char byte;
+            close(syncfd[1]);
+            while (read(syncfd[0], &byte, 1) < 0 && errno == EINTR) {
+            }
+            close(syncfd[0]);
+        }
+
+        runCommand(input);
+    }
+
+    return pid;
+}
+
+void waitCommand(pid_t pid, int *status) {
+    // Parent waits for its child process
+    while (waitpid(pid, status, 0) == -1) {
+        if (errno != EINTR) {
+            fatalError("Error: waitCommand\nwaitpid");
+        }
+    }
+
+    // Read the counters of the child and of the processes it created
+    if (perfMode) {
+        readPerfCounters();
+    }
+}
+
+int hasProcessSubstitution(const char *command) {
+    // '<(' or '>(' at the start of a word
+    for (const char *c = command; *c != '\0'; c++) {
+        if ((c[0] == '<' || c[0] == '>') && c[1] == '(' && (c == command || c[-1] == ' ')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void executeProcessSubstitutions(char *command, int *status) {
+    Substitution substitutions[MAX_SUBSTITUTIONS];
+    size_t count = 0;
+    int failed = 0;
+
+    // The outer command with each substitution replaced by its /dev/fd path
+    char *rewritten = malloc(strlen(command) + MAX_SUBSTITUTIONS * 16 + 1);
+    if (rewritten == NULL) {
+        fatalError("Error: executeProcessSubstitutions\nmalloc");
+    }
+    char *out = rewritten;
+    flushOutput();
+
+    for (char *c = command; *c != '\0';) {
+        if (!((c[0] == '<' || c[0] == '>') && c[1] == '(' && (c == command || c[-1] == ' '))) {
+            *out++ = *c++;
+            continue;
+        }
+
+        // Find the parenthesis closing the inner command
+        char *closing = NULL;
+        int depth = 0;
+        for (char *d = c + 1; *d != '\0' && closing == NULL; d++) {
+            depth += groupDelimiter(c + 1, d);
+            if (depth == 0) {
+                closing = d;
+            }
+        }
+        if (closing == NULL || count == MAX_SUBSTITUTIONS) {
+            writeDiagnostic(closing == NULL ? "enseash: syntax error: unterminated process substitution\n"
+                                            : "enseash: too many process substitutions (maximum %d)\n",
+                            MAX_SUBSTITUTIONS);
+            *status = EXIT_STATUS(2);
+            failed = 1;
+            break;
+        }
+        *closing = '\0';
+
+        Substitution *substitution = &substitutions[count];
+        substitution->direction = c[0];
+        substitution->command = c + 2;
+
+        // Pipe between the inner command and the outer command
+        int pipefd[2];
+        if (pipe(pipefd) == -1) {
+            fatalError("Error: executeProcessSubstitutions\npipe");
+        }
+        if (clock_gettime(CLOCK_MONOTONIC, &substitution->start) != 0) {
+            fatalError("Error: executeProcessSubstitutions\nclock_gettime");
+        }
+
+        substitution->pid = fork();
+        if (substitution->pid == -1) {
+            fatalError("Error: executeProcessSubstitutions\nfork");
+        }
+
+        // Child process: run the inner command on its end of the pipe
+        if (substitution->pid == 0) {
+            int end = substitution->direction == '<' ? STDOUT_FILENO : STDIN_FILENO;
+            if (dup2(pipefd[substitution->direction == '<' ? 1 : 0], end) == -1) {
+                perror("Error: executeProcessSubstitutions\ndup2");
+                exit(EXIT_FAILURE);
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+
+            // The ends of the other substitutions belong to the outer command
+            for (size_t i = 0; i < count; i++) {
+                close(substitutions[i].fd);
+            }
+            interactiveMode = 0;
+            runCommandString(substitution->command);
+        }
+
+        // Parent process: keep the end for the outer command
+        substitution->fd = pipefd[substitution->direction == '<' ? 0 : 1];
+        close(pipefd[substitution->direction == '<' ? 1 : 0]);
+        out += sprintf(out, "/dev/fd/%d", substitution->fd);
+        count++;
+        c = closing + 1;
+    }
+    *out = '\0';
+
+    // Start the outer command, which inherits the ends of the pipes
+    pid_t pid = -1;
+    if (out != rewritten && !failed) {
+        pid = startCommand(rewritten);
+    }
+    for (size_t i = 0; i < count; i++) {
+        close(substitutions[i].fd);
+    }
+
+    // Reap every participant as it terminates, timing each inner command (other children of the shell are left alone)
+    pid_t outer = pid;
+    while (1) {
+        // Next participant: the one that terminated (seen without reaping it), otherwise the first one left
+        pid_t next = outer;
+        for (size_t i = 0; i < count && next == -1; i++) {
+            next = substitutions[i].pid;
+        }
+        if (next == -1) {
+            break;
+        }
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) == 0 && info.si_pid > 0) {
+            for (size_t i = 0; i < count; i++) {
+                next = substitutions[i].pid == info.si_pid ? info.si_pid : next;
+            }
+        }
+
+        int childStatus;
+        pid_t child = waitpid(next, &childStatus, 0);
+        if (child == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatalError("Error: executeProcessSubstitutions\nwaitpid");
+        }
+
+        if (child == outer) {
+            *status = childStatus;
+            outer = -1;
+            continue;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (substitutions[i].pid == child) {
+                substitutions[i].status = childStatus;
+                if (clock_gettime(CLOCK_MONOTONIC, &substitutions[i].end) != 0) {
+                    fatalError("Error: executeProcessSubstitutions\nclock_gettime");
+                }
+                substitutions[i].pid = -1;
+            }
+        }
+    }
+    if (perfMode && pid != -1) {
+        readPerfCounters();
+    }
+
+    // Report the status and time of each inner command
+    for (size_t i = 0; i < count; i++) {
+        uint64_t microseconds = elapsedMicroseconds(&substitutions[i].start, &substitutions[i].end);
+        int signaled = WIFSIGNALED(substitutions[i].status);
+        writeFormattedMessage("%c(%s) [%s:%d|%llums]\n", substitutions[i].direction, substitutions[i].command,
+                              signaled ? "sign" : "exit",
+                              signaled ? WTERMSIG(substitutions[i].status) : WEXITSTATUS(substitutions[i].status),
+                              (unsigned long long) (microseconds / 1000));
+        recordCommandStats(substitutions[i].command, substitutions[i].status, microseconds);
+    }
+
+    free(rewritten);
+}
+
+void runCommand(char *input) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+
+    // Subshell: run the group in this process
+    if (*input == '(') {
+        runSubshell(input);
+    }
+
+    // Tokenize the input into command and arguments
+    tokenizeInput(input, args, &argCount);
+
+    // Handle commands with input and output redirection
+    if (handleRedirection(args, argCount) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Handle commands with pipe
+    handlePipe(args, argCount);
+
+    // Execute the command using execvp
+    execvp(args[0], args);
+
+    // If execvp fails, print an error message
+    fatalError("Error: executeCommand\nexecvp");
+}
+
+void tokenizeInput(char *input, char *args[], size_t *argCount) {
+    // Use strtok to split the string into tokens (words) using space as the delimiter
+    char *token = strtok(input, " ");
+    while (token != NULL && *argCount < MAX_ARGS) {
+        args[(*argCount)++] = token;
+        token = strtok(NULL, " ");
+    }
+
+    // Set the last element of the args array to NULL as required by execvp
+    args[*argCount] = NULL;
+}
+
+int handleRedirection(char *args[], size_t argCount) {
+    // File for input and output redirection
+    char *inputFile = NULL;
+    char *outputFile = NULL;
+
+    // Inline input: here-document body or here-string word
+    const char *inputData = NULL;
+    size_t inputLength = 0;
+    int inputNewline = 0;
+
+    // Iterate through the arguments to check for input and output redirection
+    for (size_t i = 0; i < argCount; i++) {
+        if (args[i] == NULL) {
+            continue;
+        }
+
+        // Here-string: '<<< word' or '<<<word'
+        else if (strncmp(args[i], "<<<", 3) == 0) {
+            inputData = args[i][3] != '\0' ? &args[i][3] : args[i + 1];
+            if (inputData == NULL) {
+                writeDiagnostic("enseash: syntax error: missing word after '<<<'\n");
+                flushOutput();
+                return -1;
+            }
+            inputLength = strlen(inputData);
+            inputNewline = 1;
+            inputFile = NULL;
+            args[i] = NULL; // Remove '<<<' from the argument list
+        }
+
+        // Here-document: '<< EOF' or '<<EOF', collected before execution
+        else if (strncmp(args[i], "<<", 2) == 0) {
+            const HereDocument *document = findHereDocument(args[i]);
+            inputData = document != NULL && document->body != NULL ? document->body : "";
+            inputLength = document != NULL ? document->length : 0;
+            inputNewline = 0;
+            inputFile = NULL;
+            args[i] = NULL; // Remove '<<' from the argument list
+        }
+
+        // Input redirection
+        else if (strcmp(args[i], "<") == 0) {
+            inputFile = args[i + 1];
+            inputData = NULL;
+            args[i] = NULL; // Remove '<' from the argument list
+        }
+
+        // Output redirection
+        else if (strcmp(args[i], ">") == 0) {
+            outputFile = args[i + 1];
+            args[i] = NULL; // Remove '>' from the argument list
+        }
+    }
+
+    // Handle inline input
+    if (inputData != NULL) {
+        // Write the data to an anonymous file
+        int fd = createInlineFile(inputData, inputLength, inputNewline);
+        if (fd == -1) {
+            return -1;
+        }
+
+        // Redirect standard input to the anonymous file
+        if (dup2(fd, STDIN_FILENO) == -1) {
+            perror("Error: handleRedirection (Inline input)\ndup2");
+            close(fd);
+            return -1;
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    // Handle input redirection
+    if (inputFile != NULL) {
+        // Open the input file for reading
+        int fd = open(inputFile, O_RDONLY);
+        if (fd == -1) {
+            perror("Error: handleRedirection (Input)\nopen");
+            return -1;
+        }
+
+        // Redirect standard input to the file
+        if (dup2(fd, STDIN_FILENO) == -1) {
+            perror("Error: handleRedirection (Input)\ndup2");
+            close(fd);
+            return -1;
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    // Handle output redirection
+    if (outputFile != NULL) {
+        // Open the output file for writing
+        int fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd == -1) {
+            perror("Error: handleRedirection (Output)\nopen");
+            return -1;
+        }
+
+        // Redirect standard output to the file
+        if (dup2(fd, STDOUT_FILENO) == -1) {
+            perror("Error: handleRedirection (Output)\ndup2");
+            close(fd);
+            return -1;
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    return 0;
+}
+
+int createInlineFile(const char *data, size_t length, int newline) {
+#ifdef __linux__
+    // Anonymous memory file: the data never touches the filesystem
+    int fd = memfd_create("enseash-inline", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    // Fallback: unlinked temporary file
+    char path[] = "/tmp/enseash-inline-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+#endif
+    if (fd == -1) {
+        perror("Error: createInlineFile\nmemfd_create");
+        return -1;
+    }
+
+    // Write the data, followed by a newline for here-strings
+    const char *end = data + length;
+    while (data < end || newline) {
+        ssize_t written = data < end ? write(fd, data, (size_t) (end - data)) : write(fd, "\n", 1);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            perror("Error: createInlineFile\nwrite");
+            close(fd);
+            return -1;
+        }
+        if (data < end) {
+            data += written;
+        } else {
+            newline = 0;
+        }
+    }
+
+#ifdef __linux__
+    // Seal the content so that the command can only read it
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        perror("Error: createInlineFile\nfcntl");
+        close(fd);
+        return -1;
+    }
+#endif
+
+    // Read from the beginning
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        perror("Error: createInlineFile\nlseek");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void handlePipe(char *args[], size_t argCount) {
+    // Iterate through the arguments to check for pipe redirection
+    for (size_t i = 0; i < argCount; i++) {
+        if (args[i] != NULL && strcmp(args[i], "|") == 0) {
+            // Set the pipe symbol to NULL to separate the first and second command
+            args[i] = NULL;
+
+            // Split the arguments into two parts
+            char **firstCommand = &args[0];
+            char **secondCommand = &args[i + 1];
+
+            // Check for errors
+            int pipefd[2];
+            if (pipe(pipefd) == -1) {
+                fatalError("Error: handlePipe\npipe");
+            }
+
+            pid_t childPid = fork();
+            if (childPid == -1) {
+                fatalError("Error: handlePipe\nfork");
+            }
+
+            // Child process: Execute the first command before the pipe
+            else if (childPid == 0) {
+                // Close the read end of the pipe since the child writes to it
+                close(pipefd[0]);
+
+                // Redirect standard output to the write end of the pipe
+                if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
+                    perror("Error: handlePipe (firstCommand)\ndup2");
+                    close(pipefd[1]);
+                    exit(EXIT_FAILURE);
+                }
+
+                // Close the write end of the pipe as it's no longer needed
+                close(pipefd[1]);
+
+                // Execute the first command using execvp
+                execvp(firstCommand[0], firstCommand);
+
+                // If execvp fails, print an error message
+                fatalError("Error: handlePipe (firstCommand)\nexecvp");
+            }
+
+            // Parent process: Execute the second command after the pipe (the shell waits for it)
+            else {
+                // Close the write end of the pipe since the parent reads from it
+                close(pipefd[1]);
+
+                // Redirect standard input to the read end of the pipe
+                if (dup2(pipefd[0], STDIN_FILENO) == -1) {
+                    perror("Error: handlePipe (secondCommand)\ndup2");
+                    close(pipefd[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                // Close the read end of the pipe as it's no longer needed
+                close(pipefd[0]);
+
+                // Execute the second command using execvp
+                execvp(secondCommand[0], secondCommand);
+
+                // If execvp fails, print an error message
+                fatalError("Error: handlePipe (secondCommand)\nexecvp");
+            }
+        }
+    }
+}
+
+
+
+// --------------------- Here-Documents --------------------- //
+int collectHereDocuments(char *input) {
+    clearHereDocuments();
+
+    char *line = input;
+    while (*line != '\0') {
+        char *lineEnd = strchr(line, '\n');
+        if (lineEnd == NULL) {
+            lineEnd = line + strlen(line);
+        }
+
+        // Find the here-document operators of the line ('<<' but not '<<<')
+        size_t first = hereDocumentCount;
+        const char *delimiters[MAX_HERE_DOCUMENTS];
+        size_t delimiterLengths[MAX_HERE_DOCUMENTS];
+        for (char *c = line; c < lineEnd; c++) {
+            if (c[0] != '<' || c[1] != '<' || c[2] == '<' || (c > input && c[-1] == '<')) {
+                continue;
+            }
+
+            // The delimiter is the word after the operator
+            char *delimiter = c + 2;
+            while (*delimiter == ' ') {
+                delimiter++;
+            }
+            size_t delimiterLength = strcspn(delimiter, " \n;&|)");
+            if (delimiterLength == 0) {
+                writeDiagnostic("enseash: syntax error: missing delimiter after '<<'\n");
+                return -1;
+            }
+            if (hereDocumentCount == MAX_HERE_DOCUMENTS) {
+                writeDiagnostic("enseash: too many here-documents (maximum %d)\n", MAX_HERE_DOCUMENTS);
+                return -1;
+            }
+            hereDocuments[hereDocumentCount].operator = c;
+            delimiters[hereDocumentCount] = delimiter;
+            delimiterLengths[hereDocumentCount] = delimiterLength;
+            hereDocumentCount++;
+            c = delimiter + delimiterLength - 1;
+        }
+
+        // The bodies follow the line, in the order of the operators
+        char *next = *lineEnd != '\0' ? lineEnd + 1 : lineEnd;
+        for (size_t i = first; i < hereDocumentCount; i++) {
+            int found = 0;
+            while (*next != '\0' && !found) {
+                char *bodyLineEnd = strchr(next, '\n');
+                size_t bodyLineLength = bodyLineEnd != NULL ? (size_t) (bodyLineEnd - next) : strlen(next);
+                char *following = bodyLineEnd != NULL ? bodyLineEnd + 1 : next + bodyLineLength;
+
+                // The body ends at the line equal to the delimiter
+                found = bodyLineLength == delimiterLengths[i] && strncmp(next, delimiters[i], bodyLineLength) == 0;
+                if (!found) {
+                    appendHereDocument(&hereDocuments[i], next, (size_t) (following - next));
+                }
+                next = following;
+            }
+
+            // In interactive mode, the body is typed after the command
+            if (!found && interactiveMode && *next == '\0') {
+                found = readHereDocument(&hereDocuments[i], delimiters[i], delimiterLengths[i]);
+            }
+            if (!found) {
+                writeDiagnostic("enseash: warning: here-document delimited by end of input (wanted '%.*s')\n",
+                                (int) delimiterLengths[i], delimiters[i]);
+            }
+        }
+
+        // Remove the bodies from the command text (the line itself does not move)
+        if (hereDocumentCount > first && *lineEnd != '\0') {
+            memmove(lineEnd + 1, next, strlen(next) + 1);
+        }
+        line = *lineEnd != '\0' ? lineEnd + 1 : lineEnd;
+    }
+    return 0;
+}
+
+void appendHereDocument(HereDocument *document, const char *data, size_t length) {
+    // Grow the body geometrically
+    if (document->length + length > document->capacity) {
+        size_t capacity = document->capacity ? document->capacity : 256;
+        while (capacity < document->length + length) {
+            capacity *= 2;
+        }
+        char *body = realloc(document->body, capacity);
+        if (body == NULL) {
+            fatalError("Error: appendHereDocument\nrealloc");
+        }
+        document->body = body;
+        document->capacity = capacity;
+    }
+    memcpy(document->body + document->length, data, length);
+    document->length += length;
+}
+
+int readHereDocument(HereDocument *document, const char *delimiter, size_t delimiterLength) {
+    char line[MAX_INPUT_SIZE + 1];
+    size_t length = 0;
+    int longLine = 0; // The current line was longer than the buffer: it cannot be the delimiter
+
+    writeMessage("> ");
+    flushOutput();
+
+    // Read one byte at a time so that the input after the delimiter is left for the next prompt
+    while (1) {
+        char byte;
+        ssize_t bytesRead = read(STDIN_FILENO, &byte, 1);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            fatalError("Error: readHereDocument\nread");
+        }
+        if (bytesRead == 0) {
+            appendHereDocument(document, line, length);
+            return 0;
+        }
+
+        // Long lines are appended in pieces
+        if (byte != '\n') {
+            if (length == MAX_INPUT_SIZE) {
+                appendHereDocument(document, line, length);
+                length = 0;
+                longLine = 1;
+            }
+            line[length++] = byte;
+            continue;
+        }
+
+        // End of line: stop at the delimiter, otherwise add the line to the body
+        if (!longLine && length == delimiterLength && strncmp(line, delimiter, length) == 0) {
+            return 1;
+        }
+        line[length++] = '\n';
+        appendHereDocument(document, line, length);
+        length = 0;
+        longLine = 0;
+        writeMessage("> ");
+        flushOutput();
+    }
+}
+
+const HereDocument *findHereDocument(const char *operator) {
+    // The token returned by strtok starts at the operator
+    for (size_t i = 0; i < hereDocumentCount; i++) {
+        if (hereDocuments[i].operator == operator) {
+            return &hereDocuments[i];
+        }
+    }
+    return NULL;
+}
+
+void clearHereDocuments(void) {
+    // Keep the body buffers for the next input
+    for (size_t i = 0; i < hereDocumentCount; i++) {
+        hereDocuments[i].operator = NULL;
+        hereDocuments[i].length = 0;
+    }
+    hereDocumentCount = 0;
+}
+
+
+
+// --------------------- Performance Counters --------------------- //
+void openPerfCounters(pid_t pid) {
+    perfCountersValid = 0;
+
+#ifdef __linux__
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+        // Counters start disabled and are enabled when the child executes the command
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perfCounters[i].type;
+        attr.config = perfCounters[i].config;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        // Software events (context switches, page faults) are counted in the kernel
+        attr.exclude_kernel = perfCounters[i].type == PERF_TYPE_HARDWARE;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Hardware counters may be missing or forbidden (virtual machines, containers)
+        perfCounters[i].fd = (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        perfCounters[i].available = perfCounters[i].fd != -1;
+        perfCounters[i].value = 0;
+        if (perfCounters[i].available) {
+            perfCountersValid = 1;
+        }
+    }
+#else
+    (void) pid;
+#endif
+}
+
+void readPerfCounters(void) {
+    perfCountersPending = perfCountersValid;
+
+#ifdef __linux__
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (!perfCounters[i].available) {
+            continue;
+        }
+
+        // Value, time enabled and time running (the counter may have been multiplexed)
+        uint64_t values[3];
+        if (read(perfCounters[i].fd, values, sizeof(values)) != (ssize_t) sizeof(values)) {
+            perfCounters[i].available = 0;
+        } else if (values[2] > 0 && values[2] < values[1]) {
+            perfCounters[i].value = (uint64_t) ((double) values[0] * values[1] / values[2]);
+        } else {
+            perfCounters[i].value = values[0];
+        }
+
+        close(perfCounters[i].fd);
+        perfCounters[i].fd = -1;
+    }
+#endif
+}
+
+
+
+// --------------------- Latency Statistics --------------------- //
+size_t histogramIndex(uint64_t value) {
+    // Small values have their own bucket
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (size_t) value;
+    }
+
+    // Keep the HISTOGRAM_SUB_BITS bits following the most significant bit
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HISTOGRAM_SUB_BITS;
+    size_t index = (size_t) (shift + 1) * HISTOGRAM_SUB_COUNT + (size_t) ((value >> shift) - HISTOGRAM_SUB_COUNT);
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t histogramValue(size_t index) {
+    // Middle of the range of values counted by the bucket
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+    int shift = (int) (index / HISTOGRAM_SUB_COUNT) - 1;
+    uint64_t lowest = (uint64_t) (HISTOGRAM_SUB_COUNT + index % HISTOGRAM_SUB_COUNT) << shift;
+    return lowest + ((1ULL << shift) >> 1);
+}
+
+uint64_t histogramPercentile(const CommandStats *stats, double percentile) {
+    // Find the bucket containing the requested rank
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) stats->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t cumulated = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        cumulated += stats->buckets[i];
+        if (cumulated >= rank) {
+            uint64_t value = histogramValue(i);
+            return value < stats->maxMicroseconds ? value : stats->maxMicroseconds;
+        }
+    }
+    return stats->maxMicroseconds;
+}
+
+void recordCommandStats(const char *input, int status, uint64_t microseconds) {
+    // The command name is the first word of the input
+    while (*input == ' ') {
+        input++;
+    }
+    size_t length = strcspn(input, " ");
+    if (length == 0) {
+        return;
+    }
+    if (length >= MAX_COMMAND_NAME) {
+        length = MAX_COMMAND_NAME - 1;
+    }
+
+    // Find the statistics of the command, or add them
+    CommandStats *stats = NULL;
+    for (size_t i = 0; i < commandStatsCount; i++) {
+        if (strncmp(commandStats[i].name, input, length) == 0 && commandStats[i].name[length] == '\0') {
+            stats = &commandStats[i];
+            break;
+        }
+    }
+    if (stats == NULL) {
+        if (commandStatsCount == commandStatsCapacity) {
+            size_t capacity = commandStatsCapacity ? commandStatsCapacity * 2 : 8;
+            CommandStats *table = realloc(commandStats, capacity * sizeof(CommandStats));
+            if (table == NULL) {
+                fatalError("Error: recordCommandStats\nrealloc");
+            }
+            commandStats = table;
+            commandStatsCapacity = capacity;
+        }
+        stats = &commandStats[commandStatsCount++];
+        memset(stats, 0, sizeof(CommandStats));
+        memcpy(stats->name, input, length);
+    }
+
+    // A command fails when it exits with a non-zero code or is terminated by a signal
+    stats->count++;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        stats->failures++;
+    }
+    if (microseconds > stats->maxMicroseconds) {
+        stats->maxMicroseconds = microseconds;
+    }
+    stats->buckets[histogramIndex(microseconds)]++;
+}
+
+void writeDuration(uint64_t microseconds) {
+    // Write a duration with a unit adapted to its magnitude
+    if (microseconds < 1000) {
+        writeFormattedMessage("%7lluus", (unsigned long long) microseconds);
+    } else if (microseconds < 1000000) {
+        writeFormattedMessage("%7.1fms", (double) microseconds / 1e3);
+    } else {
+        writeFormattedMessage("%8.2fs", (double) microseconds / 1e6);
+    }
+}
+
+void writeStatsTable(const char *format) {
+    // CSV and JSON use microseconds
+    if (strcmp(format, "csv") == 0) {
+        writeMessage("command,count,failures,p50_us,p90_us,p99_us,max_us\n");
+    } else if (strcmp(format, "json") == 0) {
+        writeMessage("[");
+    } else {
+        writeFormattedMessage("%-16s %8s %9s %9s %9s %9s %6s\n", "command", "count", "p50", "p90", "p99", "max", "fail%");
+    }
+
+    for (size_t i = 0; i < commandStatsCount; i++) {
+        const CommandStats *stats = &commandStats[i];
+        unsigned long long p50 = histogramPercentile(stats, 50.0);
+        unsigned long long p90 = histogramPercentile(stats, 90.0);
+        unsigned long long p99 = histogramPercentile(stats, 99.0);
+        unsigned long long max = stats->maxMicroseconds;
+
+        if (strcmp(format, "csv") == 0) {
+            writeFormattedMessage("%s,%llu,%llu,%llu,%llu,%llu,%llu\n", stats->name, (unsigned long long) stats->count,
+                                  (unsigned long long) stats->failures, p50, p90, p99, max);
+        } else if (strcmp(format, "json") == 0) {
+            writeFormattedMessage("%s\n  {\"command\": \"", i == 0 ? "" : ",");
+            for (const char *c = stats->name; *c != '\0'; c++) {
+                writeFormattedMessage(*c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+            }
+            writeFormattedMessage("\", \"count\": %llu, \"failures\": %llu, \"p50_us\": %llu, \"p90_us\": %llu, "
+                                  "\"p99_us\": %llu, \"max_us\": %llu}",
+                                  (unsigned long long) stats->count, (unsigned long long) stats->failures, p50, p90, p99, max);
+        } else {
+            writeFormattedMessage("%-16s %8llu ", stats->name, (unsigned long long) stats->count);
+            writeDuration(p50);
+            writeDuration(p90);
+            writeDuration(p99);
+            writeDuration(max);
+            writeFormattedMessage(" %5.1f%%\n", 100.0 * (double) stats->failures / (double) stats->count);
+        }
+    }
+
+    if (strcmp(format, "json") == 0) {
+        writeMessage(commandStatsCount > 0 ? "\n]\n" : "]\n");
+    }
+}
+
+void dumpStats(void) {
+    // Children exiting through exit() hold a stale copy of the table: only the shell dumps it
+    if (getpid() != statsOwner) {
+        return;
+    }
+
+    // Dump the table to the file named by ENSEASH_STATS, if any
+    const char *path = getenv("ENSEASH_STATS");
+    if (path == NULL || *path == '\0' || commandStatsCount == 0) {
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        perror("Error: dumpStats\nopen");
+        return;
+    }
+
+    // Reuse the output buffer, redirected to the file
+    size_t length = strlen(path);
+    flushOutputBuffer(&standardOutput);
+    standardOutput.fd = fd;
+    writeStatsTable(length > 5 && strcmp(path + length - 5, ".json") == 0 ? "json" : "csv");
+    flushOutputBuffer(&standardOutput);
+    standardOutput.fd = STDOUT_FILENO;
+    close(fd);
+}
+
+
+
+// --------------------- Builtins --------------------- //
+int isBuiltin(const char *input, const char *name) {
+    // Match the builtin name alone or followed by a space
+    size_t length = strlen(name);
+    return strncmp(input, name, length) == 0 && (input[length] == '\0' || input[length] == ' ');
+}
+
+void exitShell(int code) {
+    // Display the exit message and exit the shell
+    if (interactiveMode) {
+        writeMessage("Exiting ENSEA Shell.\n");
+    }
+    exit(code);
+}
+
+void exitBuiltin(char *input, int *status) {
+    // Skip the 'exit' word and the spaces after it
+    char *argument = input + 4;
+    while (*argument == ' ') {
+        argument++;
+    }
+
+    // Without an argument, the exit code is the one of the last command
+    int code = EXIT_CODE(*status);
+    if (*argument != '\0') {
+        char *end;
+        long value = strtol(argument, &end, 10);
+        if (*end != '\0') {
+            writeDiagnostic("exit: %s: numeric argument required\n", argument);
+            value = 2;
+        }
+        code = (int) (value & 0xff);
+    }
+    exitShell(code);
+}
+
+void execBuiltin(char *input, int *status) {
+    // Skip the 'exec' word and the spaces after it
+    char *command = input + 4;
+    while (*command == ' ') {
+        command++;
+    }
+
+    // Without a command, 'exec' does nothing
+    if (*command == '\0') {
+        *status = EXIT_STATUS(EXIT_SUCCESS);
+        return;
+    }
+
+    // Replace the shell with the command (does not return)
+    flushOutput();
+    runCommand(command);
+}
+
+
+
+void perfstatBuiltin(char *input, int *status) {
+    // Skip the 'perfstat' word and the spaces after it
+    char *argument = input + 8;
+    while (*argument == ' ') {
+        argument++;
+    }
+    *status = EXIT_STATUS(EXIT_SUCCESS);
+
+#ifdef __linux__
+    // Enable or disable the performance mode
+    if (strcmp(argument, "on") == 0 || strcmp(argument, "off") == 0) {
+        perfMode = strcmp(argument, "on") == 0;
+        perfCountersValid = 0;
+        return;
+    }
+    if (*argument != '\0') {
+        writeDiagnostic("perfstat: usage: perfstat [on|off]\n");
+        *status = EXIT_STATUS(EXIT_FAILURE);
+        return;
+    }
+
+    // Display the counters of the last command
+    if (!perfCountersValid) {
+        writeMessage(perfMode ? "perfstat: no command measured yet\n" : "perfstat: disabled (use 'perfstat on')\n");
+        return;
+    }
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (!perfCounters[i].available) {
+            writeFormattedMessage("%20s  %s\n", "not supported", perfCounters[i].description);
+        } else if (perfCounters[i].type == PERF_TYPE_SOFTWARE && perfCounters[i].config == PERF_COUNT_SW_TASK_CLOCK) {
+            writeFormattedMessage("%17.3f ms  %s\n", (double) perfCounters[i].value / 1e6, perfCounters[i].description);
+        } else {
+            writeFormattedMessage("%20llu  %s\n", (unsigned long long) perfCounters[i].value, perfCounters[i].description);
+        }
+    }
+
+    // Derived metric: instructions per cycle
+    if (perfCounters[0].available && perfCounters[1].available && perfCounters[1].value > 0) {
+        writeFormattedMessage("%20.2f  instructions per cycle\n", (double) perfCounters[0].value / perfCounters[1].value);
+    }
+#else
+    (void) argument;
+    writeDiagnostic("perfstat: performance counters are only supported on Linux\n");
+    *status = EXIT_STATUS(EXIT_FAILURE);
+#endif
+}
+
+
+
+void statsBuiltin(char *input, int *status) {
+    // Skip the 'stats' word and the spaces after it
+    char *argument = input + 5;
+    while (*argument == ' ') {
+        argument++;
+    }
+    *status = EXIT_STATUS(EXIT_SUCCESS);
+
+    // Clear the statistics of the session
+    if (strcmp(argument, "reset") == 0) {
+        commandStatsCount = 0;
+        return;
+    }
+
+    if (*argument != '\0' && strcmp(argument, "csv") != 0 && strcmp(argument, "json") != 0) {
+        writeDiagnostic("stats: usage: stats [csv|json|reset]\n");
+        *status = EXIT_STATUS(EXIT_FAILURE);
+        return;
+    }
+    if (commandStatsCount == 0 && *argument == '\0') {
+        writeMessage("stats: no command measured yet\n");
+        return;
+    }
+    writeStatsTable(argument);
+}
+
+
+
+// --------------------- Command String Mode --------------------- //
+void runCommandString(char *input) {
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+
+    // Execute the list: an external last command replaces the shell, otherwise its status is the exit code
+    executeCommandList(input, &status, 1);
+    exit(EXIT_CODE(status));
+}
+
+
+
+// --------------------- Display Status --------------------- //
+void displayPromptStatus(int status, long executionTime) {
+    // Check if the command was successful
+    if (WIFEXITED(status)) {
+        // If the command exited normally, display exit status in the prompt
+        writeStatusMessage("exit", WEXITSTATUS(status), executionTime);
+    } else if (WIFSIGNALED(status)) {
+        // If the command was terminated by a signal, display signal information in the prompt
+        writeStatusMessage("sign", WTERMSIG(status), executionTime);
+    }
+}
+
+
+
+// --------------------- Main --------------------- //
+int main(int argc, char *argv[]) {
+    // Flush pending output whenever the shell exits
+    atexit(flushOutput);
+
+    // Dump the latency statistics on exit (registered last, so it runs first)
+    statsOwner = getpid();
+    atexit(dumpStats);
+
+    // Command string mode: run the command without welcome message or prompt
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            writeDiagnostic("enseash: -c: option requires an argument\n");
+            exit(2);
+        }
+        interactiveMode = 0;
+        if (collectHereDocuments(argv[2]) == -1) {
+            exit(2);
+        }
+        runCommandString(argv[2]);
+    }
+
+    char input[MAX_INPUT_SIZE];
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+    long executionTime;
+
+    // Display the welcome message at launch
+    writeMessage("Welcome to ENSEA Shell.\nType 'exit' or press 'Ctrl+D' to quit.\n");
+
+    // Display the shell prompt
+    writeMessage("enseash % ");
+
+    // Main loop
+    while (1) {
+        // Read user input
+        ssize_t bytesRead = readPrompt(input, sizeof(input));
+
+        // Process user input and execute the command
+        processUserInput(input, bytesRead, &status, &executionTime);
+
+        // Display prompt status
+        displayPromptStatus(status, executionTime);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,235 @@
+// TP1_23_metrics_reader.c
+
+/*
+    Reader of the metrics ring published by TP1_23_metrics_ring.c (ENSEASH_METRICS):
+
+    - `TP1_23_metrics_reader NAME` displays the commands in the ring, then follows the new ones until the shell exits.
+    - `TP1_23_metrics_reader --prometheus NAME` dumps the cumulative counters and the latency histogram in the
+      Prometheus textfile format (for the textfile collector of node_exporter).
+    - The reader never blocks the shell: a slot that changed while it was copied is read again.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Metrics ring (layout shared with TP1_23_metrics_ring.c)
+#define METRICS_MAGIC 0x474e495248534e45ULL // "ENSHRING"
+#define METRICS_VERSION 1
+#define METRICS_SLOTS 1024
+#define METRICS_BUCKETS 10
+
+// Attempts to read a slot before giving up (the shell may have died while writing it)
+#define MAX_READ_ATTEMPTS 1000
+
+// Interval between two checks for new commands
+#define POLL_INTERVAL_NS 100000000L
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t reserved;
+    uint64_t index;
+    int64_t timestamp;
+    uint64_t elapsedMicroseconds;
+    int32_t exitCode;
+    int32_t signal;
+    uint64_t userMicroseconds;
+    uint64_t systemMicroseconds;
+    uint64_t maxResidentKilobytes;
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t voluntarySwitches;
+    uint64_t involuntarySwitches;
+    char name[32];
+} MetricsRecord;
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    int32_t pid;
+    uint32_t reserved;
+    uint64_t head;
+    uint64_t failures;
+    uint64_t elapsedMicroseconds;
+    uint64_t userMicroseconds;
+    uint64_t systemMicroseconds;
+    uint64_t bucketBounds[METRICS_BUCKETS];
+    uint64_t buckets[METRICS_BUCKETS + 1];
+    MetricsRecord slots[METRICS_SLOTS];
+} MetricsRing;
+
+// Metrics Ring
+const MetricsRing *openMetricsRing(const char *name);
+int readMetricsRecord(const MetricsRing *ring, uint64_t index, MetricsRecord *record);
+
+// Output
+void writeRecord(const MetricsRecord *record);
+void followRing(const MetricsRing *ring);
+void writePrometheus(const MetricsRing *ring);
+
+
+
+// --------------------- Metrics Ring --------------------- //
+const MetricsRing *openMetricsRing(const char *name) {
+    // Map the segment read-only: the reader cannot disturb the shell
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        perror("Error: openMetricsRing\nshm_open");
+        exit(EXIT_FAILURE);
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t) info.st_size < sizeof(MetricsRing)) {
+        fprintf(stderr, "Error: %s is not a metrics ring\n", name);
+        exit(EXIT_FAILURE);
+    }
+    const MetricsRing *ring = mmap(NULL, sizeof(MetricsRing), PROT_READ, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("Error: openMetricsRing\nmmap");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    // Check the layout
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC || ring->version != METRICS_VERSION ||
+        ring->slotCount != METRICS_SLOTS) {
+        fprintf(stderr, "Error: %s has an unknown layout\n", name);
+        exit(EXIT_FAILURE);
+    }
+    return ring;
+}
+
+int readMetricsRecord(const MetricsRing *ring, uint64_t index, MetricsRecord *record) {
+    const MetricsRecord *slot = &ring->slots[index & (METRICS_SLOTS - 1)];
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        // Seqlock: the copy is valid if the sequence was even and did not change
+        uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+        memcpy(record, slot, sizeof(MetricsRecord));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t after = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+        if (before == after) {
+            // The slot may already hold a newer command when the reader is too slow
+            return record->index == index ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+
+
+// --------------------- Output --------------------- //
+void writeRecord(const MetricsRecord *record) {
+    char status[16];
+    time_t seconds = (time_t) (record->timestamp / 1000000000LL);
+    struct tm local;
+    char date[16];
+    localtime_r(&seconds, &local);
+    strftime(date, sizeof(date), "%H:%M:%S", &local);
+    if (record->signal != 0) {
+        snprintf(status, sizeof(status), "sign:%d", record->signal);
+    } else {
+        snprintf(status, sizeof(status), "exit:%d", record->exitCode);
+    }
+    printf("%s #%llu %-16s [%s|%.1fms] user %.1fms sys %.1fms rss %lluKB flt %llu/%llu cs %llu/%llu\n", date,
+           (unsigned long long) record->index, record->name, status, (double) record->elapsedMicroseconds / 1e3,
+           (double) record->userMicroseconds / 1e3, (double) record->systemMicroseconds / 1e3,
+           (unsigned long long) record->maxResidentKilobytes, (unsigned long long) record->minorFaults,
+           (unsigned long long) record->majorFaults, (unsigned long long) record->voluntarySwitches,
+           (unsigned long long) record->involuntarySwitches);
+}
+
+void followRing(const MetricsRing *ring) {
+    // Start with the oldest command still in the ring
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t next = head > METRICS_SLOTS ? head - METRICS_SLOTS : 0;
+    struct timespec interval = { 0, POLL_INTERVAL_NS };
+
+    while (1) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        // Commands overwritten before they could be read
+        if (head - next > METRICS_SLOTS) {
+            printf("(%llu commands missed)\n", (unsigned long long) (head - METRICS_SLOTS - next));
+            next = head - METRICS_SLOTS;
+        }
+        for (; next < head; next++) {
+            MetricsRecord record;
+            if (readMetricsRecord(ring, next, &record) == 0) {
+                writeRecord(&record);
+            }
+        }
+        fflush(stdout);
+
+        // Stop when the shell has exited
+        if (kill(ring->pid, 0) == -1 && errno == ESRCH) {
+            return;
+        }
+        nanosleep(&interval, NULL);
+    }
+}
+
+void writePrometheus(const MetricsRing *ring) {
+    // Counters are read after the head, so they include at least the published commands
+    uint64_t count = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    int pid = ring->pid;
+
+    printf("# HELP enseash_commands_total Commands completed by the shell.\n");
+    printf("# TYPE enseash_commands_total counter\n");
+    printf("enseash_commands_total{pid=\"%d\"} %llu\n", pid, (unsigned long long) count);
+    printf("# HELP enseash_command_failures_total Commands that exited with a non-zero code or a signal.\n");
+    printf("# TYPE enseash_command_failures_total counter\n");
+    printf("enseash_command_failures_total{pid=\"%d\"} %llu\n", pid,
+           (unsigned long long) __atomic_load_n(&ring->failures, __ATOMIC_RELAXED));
+    printf("# HELP enseash_command_cpu_seconds_total CPU time of the commands.\n");
+    printf("# TYPE enseash_command_cpu_seconds_total counter\n");
+    printf("enseash_command_cpu_seconds_total{pid=\"%d\",mode=\"user\"} %.6f\n", pid,
+           (double) __atomic_load_n(&ring->userMicroseconds, __ATOMIC_RELAXED) / 1e6);
+    printf("enseash_command_cpu_seconds_total{pid=\"%d\",mode=\"system\"} %.6f\n", pid,
+           (double) __atomic_load_n(&ring->systemMicroseconds, __ATOMIC_RELAXED) / 1e6);
+
+    // Histogram buckets are cumulative in the Prometheus format
+    uint64_t cumulative = 0;
+    printf("# HELP enseash_command_duration_seconds Execution time of the commands.\n");
+    printf("# TYPE enseash_command_duration_seconds histogram\n");
+    for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += __atomic_load_n(&ring->buckets[i], __ATOMIC_RELAXED);
+        printf("enseash_command_duration_seconds_bucket{pid=\"%d\",le=\"%g\"} %llu\n", pid,
+               (double) ring->bucketBounds[i] / 1e6, (unsigned long long) cumulative);
+    }
+    cumulative += __atomic_load_n(&ring->buckets[METRICS_BUCKETS], __ATOMIC_RELAXED);
+    printf("enseash_command_duration_seconds_bucket{pid=\"%d\",le=\"+Inf\"} %llu\n", pid, (unsigned long long) cumulative);
+    printf("enseash_command_duration_seconds_sum{pid=\"%d\"} %.6f\n", pid,
+           (double) __atomic_load_n(&ring->elapsedMicroseconds, __ATOMIC_RELAXED) / 1e6);
+    printf("enseash_command_duration_seconds_count{pid=\"%d\"} %llu\n", pid, (unsigned long long) cumulative);
+}
+
+
+
+// --------------------- Main --------------------- //
+int main(int argc, char *argv[]) {
+    int prometheus = argc == 3 && strcmp(argv[1], "--prometheus") == 0;
+    if (argc != 2 + prometheus) {
+        fprintf(stderr, "usage: %s [--prometheus] NAME (such as /enseash-PID)\n", argv[0]);
+        exit(2);
+    }
+
+    const MetricsRing *ring = openMetricsRing(argv[argc - 1]);
+    if (prometheus) {
+        writePrometheus(ring);
+    } else {
+        followRing(ring);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,4145 @@
+// TP1_25_loops.c
+
+/*
+    Changes from the previous code:
+
+    - Added `for NAME in WORDS; do LIST; done` and `while LIST; do LIST; done` loops, run by the shell itself.
+    - The body (and the condition) is parsed once: simple commands are split into words, and each iteration only substitutes `$NAME` or `${NAME}` before running the commands like any list.
+    - `for`, `while` and `done` are group delimiters in command position, so loops can be nested and span several lines of a script.
+    - The outermost loop reports its total time and the minimum, average and maximum time per iteration; Ctrl+C stops it.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create, file sealing, CPU affinity and splice
+#endif
+
+#include <dirent.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#define MAX_INPUT_SIZE 100
+#define MAX_ARGS 32
+#define MAX_OUTPUT_SEGMENTS 64
+#define MAX_COMMAND_NAME 32
+#define MAX_LIST_ELEMENTS 32
+#define MAX_HERE_DOCUMENTS 16
+#define MAX_SUBSTITUTIONS 8
+#define DEFAULT_CACHE_SIZE (64ULL << 20)
+#define CACHE_MAGIC "ENSHCCH1"
+#define COMPILED_MAGIC "ENSHCMP1"
+#define COMPILED_VERSION 2  // Changed with the layout of the header or of the sections
+#define COMPILED_SUFFIX "c" // script.ensh -> script.enshc
+#define COMPILED_NONE 0     // Offset of no string
+
+// Metrics ring (layout shared with TP1_23_metrics_reader.c)
+#define METRICS_MAGIC 0x474e495248534e45ULL // "ENSHRING"
+#define METRICS_VERSION 1
+#define METRICS_SLOTS 1024 // Power of two
+#define METRICS_BUCKETS 10
+
+// Latency histogram: values below 16us are exact, above each power of two is split in 16 buckets
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAGNITUDES 37 // Up to 2^40us (about 12 days)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_COUNT)
+
+// I/O priority (no wrapper in the C library)
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+// Wait status of a process that exited normally with the given code
+#define EXIT_STATUS(code) (((code) & 0xff) << 8)
+
+// Exit code of the shell for the wait status of its last command
+#define EXIT_CODE(status) (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status))
+
+// Operator linking a command of a list to the previous one
+typedef enum {
+    LIST_SEQUENCE, // ';'
+    LIST_AND,      // '&&'
+    LIST_OR        // '||'
+} ListOperator;
+
+// Command of a list, with the operator written before it
+typedef struct {
+    char *command;
+    ListOperator operator;
+} ListElement;
+
+// Interactive mode (welcome message, prompt and exit message)
+static int interactiveMode = 1;
+
+// Output buffer: literal messages are queued by reference, formatted ones are copied into `data`
+typedef struct {
+    int fd;
+    char *data;
+    size_t length;
+    size_t capacity;
+    struct {
+        const char *message; // Literal message, or NULL for a formatted one stored in `data`
+        size_t offset;
+        size_t length;
+    } segments[MAX_OUTPUT_SEGMENTS];
+    size_t segmentCount;
+} OutputBuffer;
+
+static OutputBuffer standardOutput = { .fd = STDOUT_FILENO };
+static OutputBuffer standardError = { .fd = STDERR_FILENO };
+
+// Performance counter opened on each child when the performance mode is enabled
+typedef struct {
+    const char *name;        // Short name displayed in the status line
+    const char *description; // Name displayed by the 'perfstat' builtin
+    uint32_t type;
+    uint64_t config;
+    int hardware;
+    int fd;
+    int available;           // Counter could be opened for the last command
+    uint64_t value;          // Value scaled by the multiplexing ratio
+} PerfCounter;
+
+#ifdef __linux__
+static PerfCounter perfCounters[] = {
+    { "ins",  "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,   1, -1, 0, 0 },
+    { "cyc",  "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,     1, -1, 0, 0 },
+    { "cmis", "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,   1, -1, 0, 0 },
+    { "bmis", "branch-misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,  1, -1, 0, 0 },
+    { "task", "task-clock",       PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,     0, -1, 0, 0 },
+    { "pf",   "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,    0, -1, 0, 0 },
+    { "cs",   "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0, -1, 0, 0 },
+};
+#define PERF_COUNTER_COUNT (sizeof(perfCounters) / sizeof(perfCounters[0]))
+#endif
+
+// Performance mode (enabled by 'perfstat on'), validity of the counters of the last command
+// and whether they still have to be displayed in the status line
+static int perfMode = 0;
+static int perfCountersValid = 0;
+static int perfCountersPending = 0;
+
+// Here-document body, found by the address of its '<<' token in the input (children share it after fork)
+typedef struct {
+    const char *operator;
+    char *body;
+    size_t length;
+    size_t capacity;
+} HereDocument;
+
+static HereDocument hereDocuments[MAX_HERE_DOCUMENTS];
+static size_t hereDocumentCount = 0;
+
+// Inner command of a process substitution, connected to the outer command by a pipe
+typedef struct {
+    char direction; // '<' when the outer command reads the output, '>' when it writes the input
+    char *command;
+    pid_t pid;
+    int fd;         // End of the pipe passed to the outer command as /dev/fd/N
+    int status;
+    struct rusage usage;
+    struct timespec start;
+    struct timespec end;
+} Substitution;
+
+// Growable byte buffer
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+// Header of a cache entry, followed by the key and the output
+typedef struct {
+    char magic[8];
+    uint32_t keyLength;
+    uint32_t exitCode;
+    uint64_t outputLength;
+} CacheHeader;
+
+// Cache report of the session
+static struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;
+    uint64_t savedMicroseconds; // Estimated from the median time of the commands
+} cacheStats;
+
+// Line of a recorded session, with its timings in microseconds
+typedef struct {
+    char *command;
+    uint64_t offset; // From the start of the session
+    uint64_t recordedMicroseconds;
+    uint64_t replayedMicroseconds;
+    int recordedExitCode;
+    int replayedExitCode;
+} ReplayLine;
+
+// Session record file (--record) and start of the session
+static int sessionRecordFd = -1;
+static struct timespec sessionStart;
+
+// Counters of the '|:' meter stage
+typedef struct {
+    uint64_t bytes;
+    uint64_t readMicroseconds;  // Time waiting for the producer
+    uint64_t writeMicroseconds; // Time waiting for the consumer
+    uint64_t readStalls;
+    uint64_t writeStalls;
+} MeterStats;
+
+// Completed command published in the metrics ring
+typedef struct {
+    uint32_t sequence; // Seqlock: odd while the slot is written
+    uint32_t reserved;
+    uint64_t index;    // Number of the command in the session
+    int64_t timestamp; // End of the command (CLOCK_REALTIME, nanoseconds)
+    uint64_t elapsedMicroseconds;
+    int32_t exitCode;  // -1 when terminated by a signal
+    int32_t signal;
+    uint64_t userMicroseconds;
+    uint64_t systemMicroseconds;
+    uint64_t maxResidentKilobytes;
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t voluntarySwitches;
+    uint64_t involuntarySwitches;
+    char name[32];
+} MetricsRecord;
+
+// Shared memory segment: header, cumulative counters and ring of the last commands
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    int32_t pid;
+    uint32_t reserved;
+    uint64_t head; // Number of commands published
+    uint64_t failures;
+    uint64_t elapsedMicroseconds;
+    uint64_t userMicroseconds;
+    uint64_t systemMicroseconds;
+    uint64_t bucketBounds[METRICS_BUCKETS]; // Upper bounds in microseconds, the last bucket is +Inf
+    uint64_t buckets[METRICS_BUCKETS + 1];
+    MetricsRecord slots[METRICS_SLOTS];
+} MetricsRing;
+
+static const uint64_t metricsBucketBounds[METRICS_BUCKETS] = {
+    1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 60000000
+};
+
+static MetricsRing *metricsRing = NULL;
+static char metricsName[64];
+static pid_t metricsOwner;
+
+// Resource usage of the last command waited for
+static struct rusage commandUsage;
+
+// Compiled script: header, then the elements, stages, words (string offsets) and strings sections
+typedef struct {
+    char magic[8];
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    int64_t sourceModified; // Modification time of the source in nanoseconds
+    uint32_t elementCount;
+    uint32_t stageCount;
+    uint32_t wordCount;
+    uint32_t stringsLength;
+    uint32_t version;
+} CompiledHeader;
+
+// Command of the compiled list
+typedef struct {
+    uint8_t operator;    // ListOperator linking it to the previous command
+    uint8_t precompiled; // Otherwise, the source text runs through executeListElement
+    uint16_t stageCount;
+    uint32_t firstStage;
+    uint32_t text;       // Source text, for the statistics and the fallback
+    uint32_t inputFile;  // '<' file of the first stage
+    uint32_t outputFile; // '>' file of the last stage
+} CompiledElement;
+
+// Stage of a compiled pipe
+typedef struct {
+    uint32_t firstWord;
+    uint32_t wordCount;
+} CompiledStage;
+
+// Command of a loop body, parsed once
+typedef struct {
+    ListOperator operator;
+    char *text;               // Source text, used for groups and nested loops
+    char *args[MAX_ARGS + 1]; // Words of a simple command
+    size_t argCount;
+    int split;                // The words are used instead of the text
+} LoopCommand;
+
+typedef struct {
+    LoopCommand commands[MAX_LIST_ELEMENTS];
+    size_t count;
+} LoopBody;
+
+// Nesting level of the running loops (only the outermost one reports its timing)
+static int loopDepth = 0;
+
+// Set by Ctrl+C to stop a periodic execution or a loop
+static volatile sig_atomic_t interrupted = 0;
+
+// Latency statistics of the commands with the same name
+typedef struct {
+    char name[MAX_COMMAND_NAME];
+    uint64_t count;
+    uint64_t failures;
+    uint64_t maxMicroseconds;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} CommandStats;
+
+static CommandStats *commandStats = NULL;
+static size_t commandStatsCount = 0;
+static size_t commandStatsCapacity = 0;
+static pid_t statsOwner;
+
+// Output Buffer
+void appendOutput(OutputBuffer *buffer, const char *message, size_t length, int copy);
+void appendFormattedOutput(OutputBuffer *buffer, const char *format, va_list arguments);
+void flushOutputBuffer(OutputBuffer *buffer);
+void flushOutput(void);
+void fatalError(const char *message);
+
+// Helper Functions
+void writeMessage(const char *message);
+void writeFormattedMessage(const char *format, ...);
+void writeDiagnostic(const char *format, ...);
+void writeStatusMessage(char *command, int status, long executionTime);
+void writeScaledValue(uint64_t value);
+
+// Read Input
+ssize_t readPrompt(char *input, size_t size);
+
+// Process Input
+void processUserInput(char *input, ssize_t bytesRead, int *status, long *executionTime);
+int parseCommandList(char *input, ListElement elements[], size_t *elementCount);
+int groupDelimiter(const char *input, const char *c);
+char *splitGroup(char *command, char **redirections);
+int checkGroupRedirections(char *args[], size_t argCount);
+void executeBraceGroup(char *command, int *status, int tailCall);
+void runSubshell(char *command);
+void executeCommandList(char *input, int *status, int tailCall);
+void executeListElement(char *command, int *status, int tailCall);
+uint64_t elapsedMicroseconds(const struct timespec *start, const struct timespec *end);
+void executeCommand(char *input, int *status);
+void executeArguments(char *args[], size_t argCount, int *status);
+pid_t startProcess(void);
+pid_t startCommand(char *input);
+void waitCommand(pid_t pid, int *status);
+int hasProcessSubstitution(const char *command);
+void executeProcessSubstitutions(char *command, int *status);
+void runCommand(char *input);
+void runArguments(char *args[], size_t argCount);
+void tokenizeInput(char *input, char *args[], size_t *argCount);
+int handleRedirection(char *args[], size_t argCount);
+int createInlineFile(const char *data, size_t length, int newline);
+void handlePipe(char *args[], size_t argCount);
+
+// Scheduling
+int parseCpuList(const char *list, cpu_set_t *cpus);
+void applyScheduling(char ***command);
+
+// Throughput Meter
+void runMeter(char **firstCommand, char **secondCommand);
+void meterPipe(int in, int out, MeterStats *stats);
+void meterWait(struct pollfd *descriptor, uint64_t *microseconds, uint64_t *stalls);
+
+// Here-Documents
+int collectHereDocuments(char *input);
+char *findHereDocumentOperator(char *line, char *c, const char *lineEnd);
+void appendHereDocument(HereDocument *document, const char *data, size_t length);
+int readHereDocument(HereDocument *document, const char *delimiter, size_t delimiterLength);
+const HereDocument *findHereDocument(const char *operator);
+void moveHereDocuments(const char *from, size_t length, const char *to);
+void clearHereDocuments(void);
+
+// Performance Counters
+void openPerfCounters(pid_t pid);
+void readPerfCounters(void);
+
+// Latency Statistics
+size_t histogramIndex(uint64_t value);
+uint64_t histogramValue(size_t index);
+uint64_t histogramPercentile(const CommandStats *stats, double percentile);
+void recordCommandStats(const char *input, int status, uint64_t microseconds);
+CommandStats *findCommandStats(const char *input);
+void writeDuration(uint64_t microseconds);
+void writeStatsTable(const char *format);
+void dumpStats(void);
+
+// Builtins
+int isBuiltin(const char *input, const char *name);
+void exitShell(int code);
+void exitBuiltin(char *input, int *status);
+void execBuiltin(char *input, int *status);
+void perfstatBuiltin(char *input, int *status);
+void statsBuiltin(char *input, int *status);
+void everyBuiltin(char *input, int *status);
+void repeatBuiltin(char *input, int *status);
+
+// Loops
+int keywordAt(const char *input, const char *c, const char *keyword);
+int parseLoopBody(char *list, LoopBody *body);
+void freeLoopBody(LoopBody *body);
+void appendSubstituted(ByteBuffer *buffer, const char *text, const char *name, const char *value);
+void runLoopBody(const LoopBody *body, const char *name, const char *value, int *status);
+void executeLoop(char *command, int *status);
+
+// Output Cache
+void appendBytes(ByteBuffer *buffer, const void *data, size_t length);
+uint64_t hashBytes(const void *data, size_t length);
+int cacheDirectory(char *path, size_t size);
+int buildCacheKey(char *command, ByteBuffer *key, char *outputFile, size_t size);
+int readCacheEntry(const char *path, const ByteBuffer *key, ByteBuffer *output, int *exitCode);
+void writeCacheEntry(const char *path, const ByteBuffer *key, const ByteBuffer *output, int exitCode);
+void evictCacheEntries(const char *directory);
+void captureCommand(char *command, int fd, ByteBuffer *output, int *status);
+void writeAll(int fd, const char *data, size_t length);
+void cachedBuiltin(char *input, int *status);
+
+// Periodic Execution
+int parseDuration(const char *text, uint64_t *nanoseconds);
+void runPeriodically(const char *command, uint64_t count, uint64_t period, int *status);
+void handleInterrupt(int signal);
+
+// Session Record
+void openSessionRecord(const char *path);
+void recordSessionLine(const char *line, const struct timespec *start, int status, uint64_t microseconds);
+int parseSessionLine(char *line, ReplayLine *replayLine);
+void replaySession(const char *path, int fast, double threshold);
+
+// Metrics Ring
+void openMetricsRing(void);
+void publishCommandMetrics(const char *name, size_t length, int status, uint64_t microseconds);
+void closeMetricsRing(void);
+
+// Scripts
+char *readScript(const char *path, size_t *length);
+char *nextStatement(char *script, char **cursor);
+void runScript(const char *path);
+
+// Compiled Scripts
+uint32_t appendString(ByteBuffer *strings, const char *text);
+int isSimpleCommand(char *command);
+int compileElement(char *command, CompiledElement *element, ByteBuffer *stages, ByteBuffer *words, ByteBuffer *strings);
+void compileScript(const char *path);
+const CompiledHeader *loadCompiledScript(const char *compiledPath, const char *path, const struct stat *sourceInfo,
+                                         char **script, size_t *length, size_t *size);
+int checkCompiledScript(const CompiledHeader *image, size_t size);
+void runCompiledScript(const CompiledHeader *image);
+size_t compiledStrings(const CompiledHeader *image);
+void runCompiledCommand(const CompiledHeader *image, const CompiledElement *element);
+
+// Command String Mode
+void runCommandString(char *input);
+
+// Display Status
+void displayPromptStatus(int status, long executionTime);
+
+
+
+// -------------------- Output Buffer -------------------- //
+void appendOutput(OutputBuffer *buffer, const char *message, size_t length, int copy) {
+    // Flush when the segment table is full
+    if (buffer->segmentCount == MAX_OUTPUT_SEGMENTS) {
+        flushOutputBuffer(buffer);
+    }
+
+    // Copy the message into the buffer, growing it when needed
+    size_t offset = buffer->length;
+    if (copy) {
+        if (buffer->length + length > buffer->capacity) {
+            size_t capacity = buffer->capacity ? buffer->capacity : 256;
+            while (capacity < buffer->length + length) {
+                capacity *= 2;
+            }
+            char *data = realloc(buffer->data, capacity);
+            if (data == NULL) {
+                fatalError("Error: appendOutput\nrealloc");
+            }
+            buffer->data = data;
+            buffer->capacity = capacity;
+        }
+        memcpy(buffer->data + buffer->length, message, length);
+        buffer->length += length;
+    }
+
+    // Record the segment (the address of a copied message is resolved at flush time)
+    buffer->segments[buffer->segmentCount].message = copy ? NULL : message;
+    buffer->segments[buffer->segmentCount].offset = offset;
+    buffer->segments[buffer->segmentCount].length = length;
+    buffer->segmentCount++;
+}
+
+void appendFormattedOutput(OutputBuffer *buffer, const char *format, va_list arguments) {
+    // Measure the formatted message first so that it is never truncated
+    va_list copy;
+    va_copy(copy, arguments);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (length < 0) {
+        return;
+    }
+
+    // Format on the stack when the message is short, otherwise on the heap
+    char small[256];
+    char *message = (size_t) length < sizeof(small) ? small : malloc((size_t) length + 1);
+    if (message == NULL) {
+        fatalError("Error: appendFormattedOutput\nmalloc");
+    }
+    vsnprintf(message, (size_t) length + 1, format, arguments);
+    appendOutput(buffer, message, (size_t) length, 1);
+    if (message != small) {
+        free(message);
+    }
+}
+
+void flushOutputBuffer(OutputBuffer *buffer) {
+    struct iovec iov[MAX_OUTPUT_SEGMENTS];
+    int iovCount = 0;
+
+    // Gather the segments, merging formatted messages that are contiguous in the buffer
+    for (size_t i = 0; i < buffer->segmentCount; i++) {
+        const char *base = buffer->segments[i].message;
+        if (base == NULL) {
+            base = buffer->data + buffer->segments[i].offset;
+            if (iovCount > 0 && (char *) iov[iovCount - 1].iov_base + iov[iovCount - 1].iov_len == base) {
+                iov[iovCount - 1].iov_len += buffer->segments[i].length;
+                continue;
+            }
+        }
+        iov[iovCount].iov_base = (void *) base;
+        iov[iovCount].iov_len = buffer->segments[i].length;
+        iovCount++;
+    }
+    buffer->segmentCount = 0;
+    buffer->length = 0;
+
+    // Write everything with one writev, resuming after partial writes
+    struct iovec *current = iov;
+    while (iovCount > 0) {
+        ssize_t written = writev(buffer->fd, current, iovCount);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (iovCount > 0 && (size_t) written >= current->iov_len) {
+            written -= (ssize_t) current->iov_len;
+            current++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            current->iov_base = (char *) current->iov_base + written;
+            current->iov_len -= (size_t) written;
+        }
+    }
+}
+
+void flushOutput(void) {
+    // Diagnostics first, so that they appear before the next prompt
+    flushOutputBuffer(&standardError);
+    flushOutputBuffer(&standardOutput);
+}
+
+void fatalError(const char *message) {
+    // Flush pending output without losing the error number reported by perror
+    int savedErrno = errno;
+    flushOutput();
+    errno = savedErrno;
+
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
+
+
+// -------------------- Helper Functions -------------------- //
+void writeMessage(const char *message) {
+    // Queue the message for the standard output (literal messages are not copied)
+    appendOutput(&standardOutput, message, strlen(message), 0);
+}
+
+void writeFormattedMessage(const char *format, ...) {
+    // Queue a formatted message for the standard output
+    va_list arguments;
+    va_start(arguments, format);
+    appendFormattedOutput(&standardOutput, format, arguments);
+    va_end(arguments);
+}
+
+void writeDiagnostic(const char *format, ...) {
+    // Queue a formatted message for the standard error
+    va_list arguments;
+    va_start(arguments, format);
+    appendFormattedOutput(&standardError, format, arguments);
+    va_end(arguments);
+}
+
+void writeStatusMessage(char *command, int status, long executionTime) {
+    // Create a prompt message with the specified command, status and execution time
+    writeFormattedMessage("enseash [%s:%d|%ldms", command, status, executionTime);
+
+#ifdef __linux__
+    // Extend the prompt with the counters of the last command (hardware ones when permitted)
+    if (perfMode && perfCountersValid && perfCountersPending) {
+        perfCountersPending = 0;
+        int hardware = perfCounters[0].available;
+        for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+            if (perfCounters[i].available && perfCounters[i].hardware == hardware) {
+                writeFormattedMessage("|%s:", perfCounters[i].name);
+                if (perfCounters[i].config == PERF_COUNT_SW_TASK_CLOCK && perfCounters[i].type == PERF_TYPE_SOFTWARE) {
+                    writeFormattedMessage("%.1fms", (double) perfCounters[i].value / 1e6);
+                } else {
+                    writeScaledValue(perfCounters[i].value);
+                }
+            }
+        }
+    }
+#endif
+
+    writeMessage("] % ");
+}
+
+void writeScaledValue(uint64_t value) {
+    // Write a counter value with a K/M/G suffix
+    if (value >= 1000000000ULL) {
+        writeFormattedMessage("%.1fG", (double) value / 1e9);
+    } else if (value >= 1000000ULL) {
+        writeFormattedMessage("%.1fM", (double) value / 1e6);
+    } else if (value >= 1000ULL) {
+        writeFormattedMessage("%.1fK", (double) value / 1e3);
+    } else {
+        writeFormattedMessage("%llu", (unsigned long long) value);
+    }
+}
+
+
+
+// --------------------- Read Input --------------------- //
+ssize_t readPrompt(char *input, size_t size) {
+    // Flush the prompt before blocking on input
+    flushOutput();
+
+    // Read input from standard input
+    ssize_t bytesRead = read(STDIN_FILENO, input, size);
+
+    // Check for errors during input reading
+    if (bytesRead < 0) {
+        fatalError("Error: readPrompt\nread");
+    }
+
+    // Remove trailing newline character (\n)
+    if (bytesRead > 0) {
+        input[bytesRead - 1] = '\0';
+    }
+
+    // Return the number of bytes read
+    return bytesRead;
+}
+
+
+
+// --------------------- Process Input --------------------- //
+void processUserInput(char *input, ssize_t bytesRead, int *status, long *executionTime) {
+    // Exit the shell with Ctrl+D
+    if (bytesRead == 0) {
+        if (interactiveMode) {
+            writeMessage("\n");
+        }
+        exitShell(EXIT_CODE(*status));
+    }
+
+    // Initialize timestamps (time.h)
+    struct timespec start_time, end_time;
+
+    // Get start time
+    if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+        fatalError("Error: processUserInput (Start Time)\nclock_gettime");
+    }
+
+    // Keep the line for the session record (the list is parsed in place)
+    char line[MAX_INPUT_SIZE];
+    if (sessionRecordFd != -1) {
+        memcpy(line, input, strlen(input) + 1);
+    }
+
+    // Execute the user command list and wait for completion
+    if (collectHereDocuments(input) == -1) {
+        *status = EXIT_STATUS(2);
+    } else {
+        executeCommandList(input, status, 0);
+    }
+
+    // Get the end time
+    if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+        fatalError("Error: processUserInput (End Time)\nclock_gettime");
+    }
+
+    // Calculate the execution time of the whole list in milliseconds
+    uint64_t microseconds = elapsedMicroseconds(&start_time, &end_time);
+    *executionTime = (long) (microseconds / 1000);
+
+    // Log the line with its status and timing
+    if (sessionRecordFd != -1) {
+        recordSessionLine(line, &start_time, *status, microseconds);
+    }
+}
+
+int parseCommandList(char *input, ListElement elements[], size_t *elementCount) {
+    static const char *operatorNames[] = { ";", "&&", "||" };
+    ListOperator operator = LIST_SEQUENCE;
+    char *start = input;
+    int depth = 0;
+    *elementCount = 0;
+
+    for (char *c = input; ; c++) {
+        int atEnd = *c == '\0';
+
+        // List operators inside a group belong to the group
+        int delimiter = atEnd ? 0 : groupDelimiter(input, c);
+        depth += delimiter;
+        if (depth < 0) {
+            writeDiagnostic("enseash: syntax error near '%c'\n", *c);
+            return -1;
+        }
+        if (atEnd && depth > 0) {
+            writeDiagnostic("enseash: syntax error: unterminated group\n");
+            return -1;
+        }
+        if (delimiter != 0 || (depth > 0 && !atEnd)) {
+            continue;
+        }
+
+        // Find the end of the current command: end of input, newline or list operator
+        ListOperator next = LIST_SEQUENCE;
+        size_t length = 1;
+        int atNewline = *c == '\n';
+        if (atEnd || atNewline || *c == ';') {
+            next = LIST_SEQUENCE;
+        } else if (c[0] == '&' && c[1] == '&') {
+            next = LIST_AND;
+            length = 2;
+        } else if (c[0] == '|' && c[1] == '|') {
+            next = LIST_OR;
+            length = 2;
+        } else {
+            continue;
+        }
+
+        // Terminate the command and trim its spaces
+        *c = '\0';
+        while (*start == ' ') {
+            start++;
+        }
+        for (char *end = c; end > start && end[-1] == ' '; end--) {
+            end[-1] = '\0';
+        }
+
+        // Empty lines are skipped (a list operator continues on the next line)
+        if (*start == '\0' && atNewline) {
+            start = c + 1;
+            continue;
+        }
+
+        // An empty command is only allowed at the end of the input, after ';'
+        if (*start == '\0') {
+            if (atEnd && operator == LIST_SEQUENCE) {
+                return 0;
+            }
+            writeDiagnostic("enseash: syntax error near '%s'\n", atEnd ? operatorNames[operator] : operatorNames[next]);
+            return -1;
+        }
+        if (*elementCount == MAX_LIST_ELEMENTS) {
+            writeDiagnostic("enseash: too many commands in the list (maximum %d)\n", MAX_LIST_ELEMENTS);
+            return -1;
+        }
+        elements[*elementCount].command = start;
+        elements[*elementCount].operator = operator;
+        (*elementCount)++;
+
+        if (atEnd) {
+            return 0;
+        }
+
+        // The next command starts after the operator
+        operator = next;
+        c += length - 1;
+        start = c + 1;
+    }
+}
+
+int groupDelimiter(const char *input, const char *c) {
+    // Parentheses always delimit a subshell
+    if (*c == '(') {
+        return 1;
+    }
+    if (*c == ')') {
+        return -1;
+    }
+
+    // Loops are delimited by 'for' or 'while' and 'done' in command position
+    if (keywordAt(input, c, "for") || keywordAt(input, c, "while")) {
+        return 1;
+    }
+    if (keywordAt(input, c, "done")) {
+        return -1;
+    }
+
+    // Braces only delimit a group when they are separate words
+    if (*c != '{' && *c != '}') {
+        return 0;
+    }
+    int wordStart = c == input || strchr(" \n;&|(", c[-1]) != NULL;
+    int wordEnd = strchr(" \n;)", c[1]) != NULL;
+    if (!wordStart || !wordEnd) {
+        return 0;
+    }
+    return *c == '{' ? 1 : -1;
+}
+
+char *splitGroup(char *command, char **redirections) {
+    // Find the delimiter closing the group that starts the command
+    char closer = *command == '(' ? ')' : '}';
+    int depth = 0;
+    for (char *c = command; *c != '\0'; c++) {
+        depth += groupDelimiter(command, c);
+        if (depth == 0) {
+            if (*c != closer) {
+                break;
+            }
+
+            // The group is followed by its redirections
+            *c = '\0';
+            *redirections = c + 1;
+            return command + 1;
+        }
+    }
+
+    writeDiagnostic("enseash: syntax error: unterminated group\n");
+    return NULL;
+}
+
+int checkGroupRedirections(char *args[], size_t argCount) {
+    // Only redirections ('< file', '> file', '<<EOF', '<<< word') may follow a group
+    for (size_t i = 0; i < argCount; i++) {
+        int operator = strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0 || strcmp(args[i], "<<") == 0 ||
+                       strcmp(args[i], "<<<") == 0;
+        if ((!operator && strncmp(args[i], "<<", 2) != 0) || (operator && i + 1 == argCount)) {
+            writeDiagnostic("enseash: syntax error near '%s' after a group\n", args[i]);
+            return -1;
+        }
+        if (operator) {
+            i++;
+        }
+    }
+    return 0;
+}
+
+void executeBraceGroup(char *command, int *status, int tailCall) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+    char *redirections;
+
+    // Split the group and its redirections
+    char *inner = splitGroup(command, &redirections);
+    if (inner != NULL) {
+        tokenizeInput(redirections, args, &argCount);
+    }
+    if (inner == NULL || checkGroupRedirections(args, argCount) == -1) {
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    // Without redirections, the group is just a list
+    if (argCount == 0) {
+        executeCommandList(inner, status, tailCall);
+        return;
+    }
+
+    // Save the standard input and output once for the whole group
+    flushOutput();
+    int savedInput = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+    int savedOutput = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (savedInput == -1 || savedOutput == -1) {
+        fatalError("Error: executeBraceGroup\nfcntl");
+    }
+
+    // Run the list with the redirections of the group
+    if (handleRedirection(args, argCount) == -1) {
+        *status = EXIT_STATUS(EXIT_FAILURE);
+    } else {
+        executeCommandList(inner, status, tailCall);
+    }
+
+    // Write the shell's own output to the redirected descriptors, then restore them
+    flushOutput();
+    if (dup2(savedInput, STDIN_FILENO) == -1 || dup2(savedOutput, STDOUT_FILENO) == -1) {
+        fatalError("Error: executeBraceGroup\ndup2");
+    }
+    close(savedInput);
+    close(savedOutput);
+}
+
+void runSubshell(char *command) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+    char *redirections;
+
+    // Split the group and its redirections
+    char *inner = splitGroup(command, &redirections);
+    if (inner != NULL) {
+        tokenizeInput(redirections, args, &argCount);
+    }
+    if (inner == NULL || checkGroupRedirections(args, argCount) == -1) {
+        flushOutput();
+        exit(2);
+    }
+
+    // Handle the redirections of the group
+    if (handleRedirection(args, argCount) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Run the list like a command string: its last command replaces this process
+    interactiveMode = 0;
+    runCommandString(inner);
+}
+
+void executeCommandList(char *input, int *status, int tailCall) {
+    ListElement elements[MAX_LIST_ELEMENTS];
+    size_t elementCount;
+
+    // Split the input into commands
+    if (parseCommandList(input, elements, &elementCount) == -1) {
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    for (size_t i = 0; i < elementCount; i++) {
+        // '&&' and '||' decide from the status of the last command that ran
+        int succeeded = WIFEXITED(*status) && WEXITSTATUS(*status) == 0;
+        if ((elements[i].operator == LIST_AND && !succeeded) || (elements[i].operator == LIST_OR && succeeded)) {
+            continue;
+        }
+
+        // In command string mode, the last command replaces the shell
+        executeListElement(elements[i].command, status, tailCall && i == elementCount - 1);
+    }
+}
+
+void executeListElement(char *command, int *status, int tailCall) {
+    // Exit the shell with 'exit' command
+    if (isBuiltin(command, "exit")) {
+        exitBuiltin(command, status);
+    }
+
+    // Replace the shell with 'exec' command
+    else if (isBuiltin(command, "exec")) {
+        execBuiltin(command, status);
+    }
+
+    // Enable, disable or display the performance counters with 'perfstat' command
+    else if (isBuiltin(command, "perfstat")) {
+        perfstatBuiltin(command, status);
+    }
+
+    // Display the latency statistics with 'stats' command
+    else if (isBuiltin(command, "stats")) {
+        statsBuiltin(command, status);
+    }
+
+    // Replay or store the output of a deterministic command with 'cached' prefix
+    else if (isBuiltin(command, "cached")) {
+        cachedBuiltin(command, status);
+    }
+
+    // Run a command periodically with 'every' and 'repeat' commands
+    else if (isBuiltin(command, "every")) {
+        everyBuiltin(command, status);
+    } else if (isBuiltin(command, "repeat")) {
+        repeatBuiltin(command, status);
+    }
+
+    // Loops: run in the shell process
+    else if (isBuiltin(command, "for") || isBuiltin(command, "while")) {
+        executeLoop(command, status);
+    }
+
+    // Brace group: run in the shell process
+    else if (groupDelimiter(command, command) == 1 && *command == '{') {
+        executeBraceGroup(command, status, tailCall);
+    }
+
+    // Last external command of a command string: replace the shell instead of forking and waiting
+    // (not with process substitutions, whose commands are reaped by the shell)
+    else if (tailCall && !hasProcessSubstitution(command)) {
+        flushOutput();
+        runCommand(command);
+    }
+
+    // External command: direct child of the shell
+    else {
+        struct timespec start_time, end_time;
+
+        if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+            fatalError("Error: executeListElement (Start Time)\nclock_gettime");
+        }
+
+        // Execute the command and wait for completion
+        if (hasProcessSubstitution(command)) {
+            executeProcessSubstitutions(command, status);
+        } else {
+            executeCommand(command, status);
+        }
+
+        if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+            fatalError("Error: executeListElement (End Time)\nclock_gettime");
+        }
+
+        // Record the execution time in the histogram of the command (the parent's input is not tokenized)
+        if (*command != '(') {
+            recordCommandStats(command, *status, elapsedMicroseconds(&start_time, &end_time));
+        }
+    }
+}
+
+uint64_t elapsedMicroseconds(const struct timespec *start, const struct timespec *end) {
+    // Difference between two timestamps in microseconds
+    long seconds = end->tv_sec - start->tv_sec;
+    long nanoseconds = end->tv_nsec - start->tv_nsec;
+    return (uint64_t) (seconds * 1000000 + nanoseconds / 1000);
+}
+
+void executeCommand(char *input, int *status) {
+    // Create the child process and wait for its completion
+    pid_t pid = startCommand(input);
+    waitCommand(pid, status);
+}
+
+void executeArguments(char *args[], size_t argCount, int *status) {
+    // Same as executeCommand, with the words already split
+    pid_t pid = startProcess();
+    if (pid == 0) {
+        runArguments(args, argCount);
+    }
+    waitCommand(pid, status);
+}
+
+pid_t startProcess(void) {
+    // Flush pending output so that the child does not inherit it
+    flushOutput();
+
+    // In performance mode, the child waits on this pipe until its counters are opened
+    int syncfd[2] = { -1, -1 };
+    if (perfMode && pipe(syncfd) == -1) {
+        fatalError("Error: startCommand\npipe");
+    }
+
+    // Create a child process
+    pid_t pid = fork();
+
+    // Check for errors
+    if (pid == -1) {
+        fatalError("Error: startCommand\nfork");
+    }
+
+    // Parent process
+    else if (pid != 0) {
+        // Open the counters on the child, then release it
+        if (perfMode) {
+            close(syncfd[0]);
+            openPerfCounters(pid);
+            close(syncfd[1]);
+        }
+    }
+
+    // Child process
+    else {
+        // Wait until the parent has opened the counters (end of file on the pipe)
+        if (perfMode) {
+            char byte;
+            close(syncfd[1]);
+            while (read(syncfd[0], &byte, 1) < 0 && errno == EINTR) {
+            }
+            close(syncfd[0]);
+        }
+    }
+
+    return pid;
+}
+
+pid_t startCommand(char *input) {
+    // The child runs the command
+    pid_t pid = startProcess();
+    if (pid == 0) {
+        runCommand(input);
+    }
+    return pid;
+}
+
+void waitCommand(pid_t pid, int *status) {
+    // Parent waits for its child process (and gets its resource usage)
+    while (wait4(pid, status, 0, &commandUsage) == -1) {
+        if (errno != EINTR) {
+            fatalError("Error: waitCommand\nwait4");
+        }
+    }
+
+    // Read the counters of the child and of the processes it created
+    if (perfMode) {
+        readPerfCounters();
+    }
+}
+
+int hasProcessSubstitution(const char *command) {
+    // '<(' or '>(' at the start of a word
+    for (const char *c = command; *c != '\0'; c++) {
+        if ((c[0] == '<' || c[0] == '>') && c[1] == '(' && (c == command || c[-1] == ' ')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void executeProcessSubstitutions(char *command, int *status) {
+    Substitution substitutions[MAX_SUBSTITUTIONS];
+    size_t count = 0;
+    int failed = 0;
+
+    // The outer command with each substitution replaced by its /dev/fd path
+    char *rewritten = malloc(strlen(command) + MAX_SUBSTITUTIONS * 16 + 1);
+    if (rewritten == NULL) {
+        fatalError("Error: executeProcessSubstitutions\nmalloc");
+    }
+    char *out = rewritten;
+    flushOutput();
+
+    for (char *c = command; *c != '\0';) {
+        if (!((c[0] == '<' || c[0] == '>') && c[1] == '(' && (c == command || c[-1] == ' '))) {
+            *out++ = *c++;
+            continue;
+        }
+
+        // Find the parenthesis closing the inner command
+        char *closing = NULL;
+        int depth = 0;
+        for (char *d = c + 1; *d != '\0' && closing == NULL; d++) {
+            depth += groupDelimiter(c + 1, d);
+            if (depth == 0) {
+                closing = d;
+            }
+        }
+        if (closing == NULL || count == MAX_SUBSTITUTIONS) {
+            writeDiagnostic(closing == NULL ? "enseash: syntax error: unterminated process substitution\n"
+                                            : "enseash: too many process substitutions (maximum %d)\n",
+                            MAX_SUBSTITUTIONS);
+            *status = EXIT_STATUS(2);
+            failed = 1;
+            break;
+        }
+        *closing = '\0';
+
+        Substitution *substitution = &substitutions[count];
+        substitution->direction = c[0];
+        substitution->command = c + 2;
+
+        // Pipe between the inner command and the outer command
+        int pipefd[2];
+        if (pipe(pipefd) == -1) {
+            fatalError("Error: executeProcessSubstitutions\npipe");
+        }
+        if (clock_gettime(CLOCK_MONOTONIC, &substitution->start) != 0) {
+            fatalError("Error: executeProcessSubstitutions\nclock_gettime");
+        }
+
+        substitution->pid = fork();
+        if (substitution->pid == -1) {
+            fatalError("Error: executeProcessSubstitutions\nfork");
+        }
+
+        // Child process: run the inner command on its end of the pipe
+        if (substitution->pid == 0) {
+            int end = substitution->direction == '<' ? STDOUT_FILENO : STDIN_FILENO;
+            if (dup2(pipefd[substitution->direction == '<' ? 1 : 0], end) == -1) {
+                perror("Error: executeProcessSubstitutions\ndup2");
+                exit(EXIT_FAILURE);
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+
+            // The ends of the other substitutions belong to the outer command
+            for (size_t i = 0; i < count; i++) {
+                close(substitutions[i].fd);
+            }
+            interactiveMode = 0;
+            runCommandString(substitution->command);
+        }
+
+        // Parent process: keep the end for the outer command
+        substitution->fd = pipefd[substitution->direction == '<' ? 0 : 1];
+        close(pipefd[substitution->direction == '<' ? 1 : 0]);
+        out += sprintf(out, "/dev/fd/%d", substitution->fd);
+        count++;
+        c = closing + 1;
+    }
+    *out = '\0';
+
+    // Start the outer command, which inherits the ends of the pipes
+    pid_t pid = -1;
+    if (out != rewritten && !failed) {
+        pid = startCommand(rewritten);
+    }
+    for (size_t i = 0; i < count; i++) {
+        close(substitutions[i].fd);
+    }
+
+    // Reap every participant as it terminates, timing each inner command (other children of the shell are left alone)
+    pid_t outer = pid;
+    while (1) {
+        // Next participant: the one that terminated (seen without reaping it), otherwise the first one left
+        pid_t next = outer;
+        for (size_t i = 0; i < count && next == -1; i++) {
+            next = substitutions[i].pid;
+        }
+        if (next == -1) {
+            break;
+        }
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) == 0 && info.si_pid > 0) {
+            for (size_t i = 0; i < count; i++) {
+                next = substitutions[i].pid == info.si_pid ? info.si_pid : next;
+            }
+        }
+
+        int childStatus;
+        struct rusage usage;
+        pid_t child = wait4(next, &childStatus, 0, &usage);
+        if (child == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatalError("Error: executeProcessSubstitutions\nwait4");
+        }
+
+        if (child == outer) {
+            *status = childStatus;
+            commandUsage = usage;
+            outer = -1;
+            continue;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (substitutions[i].pid == child) {
+                substitutions[i].status = childStatus;
+                substitutions[i].usage = usage;
+                if (clock_gettime(CLOCK_MONOTONIC, &substitutions[i].end) != 0) {
+                    fatalError("Error: executeProcessSubstitutions\nclock_gettime");
+                }
+                substitutions[i].pid = -1;
+            }
+        }
+    }
+    if (perfMode && pid != -1) {
+        readPerfCounters();
+    }
+
+    // Report the status and time of each inner command (the usage of the outer one is recorded by the caller)
+    struct rusage outerUsage = commandUsage;
+    for (size_t i = 0; i < count; i++) {
+        commandUsage = substitutions[i].usage;
+        uint64_t microseconds = elapsedMicroseconds(&substitutions[i].start, &substitutions[i].end);
+        int signaled = WIFSIGNALED(substitutions[i].status);
+        writeFormattedMessage("%c(%s) [%s:%d|%llums]\n", substitutions[i].direction, substitutions[i].command,
+                              signaled ? "sign" : "exit",
+                              signaled ? WTERMSIG(substitutions[i].status) : WEXITSTATUS(substitutions[i].status),
+                              (unsigned long long) (microseconds / 1000));
+        recordCommandStats(substitutions[i].command, substitutions[i].status, microseconds);
+    }
+    commandUsage = outerUsage;
+
+    free(rewritten);
+}
+
+void runCommand(char *input) {
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+
+    // Subshell: run the group in this process
+    if (*input == '(') {
+        runSubshell(input);
+    }
+
+    // Tokenize the input into command and arguments
+    tokenizeInput(input, args, &argCount);
+    runArguments(args, argCount);
+}
+
+void runArguments(char *args[], size_t argCount) {
+    // Handle commands with input and output redirection
+    if (handleRedirection(args, argCount) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    // Handle commands with pipe
+    handlePipe(args, argCount);
+
+    // Apply the 'sched' prefix of the command
+    char **command = args;
+    applyScheduling(&command);
+
+    // Execute the command using execvp
+    execvp(command[0], command);
+
+    // If execvp fails, print an error message
+    fatalError("Error: executeCommand\nexecvp");
+}
+
+void tokenizeInput(char *input, char *args[], size_t *argCount) {
+    // Use strtok to split the string into tokens (words) using space as the delimiter
+    char *token = strtok(input, " ");
+    while (token != NULL && *argCount < MAX_ARGS) {
+        args[(*argCount)++] = token;
+        token = strtok(NULL, " ");
+    }
+
+    // Set the last element of the args array to NULL as required by execvp
+    args[*argCount] = NULL;
+}
+
+int handleRedirection(char *args[], size_t argCount) {
+    // File for input and output redirection
+    char *inputFile = NULL;
+    char *outputFile = NULL;
+
+    // Inline input: here-document body or here-string word
+    const char *inputData = NULL;
+    size_t inputLength = 0;
+    int inputNewline = 0;
+
+    // Iterate through the arguments to check for input and output redirection
+    for (size_t i = 0; i < argCount; i++) {
+        if (args[i] == NULL) {
+            continue;
+        }
+
+        // Here-string: '<<< word' or '<<<word'
+        else if (strncmp(args[i], "<<<", 3) == 0) {
+            inputData = args[i][3] != '\0' ? &args[i][3] : args[i + 1];
+            if (inputData == NULL) {
+                writeDiagnostic("enseash: syntax error: missing word after '<<<'\n");
+                flushOutput();
+                return -1;
+            }
+            inputLength = strlen(inputData);
+            inputNewline = 1;
+            inputFile = NULL;
+            args[i] = NULL; // Remove '<<<' from the argument list
+        }
+
+        // Here-document: '<< EOF' or '<<EOF', collected before execution
+        else if (strncmp(args[i], "<<", 2) == 0) {
+            const HereDocument *document = findHereDocument(args[i]);
+            inputData = document != NULL && document->body != NULL ? document->body : "";
+            inputLength = document != NULL ? document->length : 0;
+            inputNewline = 0;
+            inputFile = NULL;
+            args[i] = NULL; // Remove '<<' from the argument list
+        }
+
+        // Input redirection
+        else if (strcmp(args[i], "<") == 0) {
+            inputFile = args[i + 1];
+            inputData = NULL;
+            args[i] = NULL; // Remove '<' from the argument list
+        }
+
+        // Output redirection
+        else if (strcmp(args[i], ">") == 0) {
+            outputFile = args[i + 1];
+            args[i] = NULL; // Remove '>' from the argument list
+        }
+    }
+
+    // Handle inline input
+    if (inputData != NULL) {
+        // Write the data to an anonymous file
+        int fd = createInlineFile(inputData, inputLength, inputNewline);
+        if (fd == -1) {
+            return -1;
+        }
+
+        // Redirect standard input to the anonymous file
+        if (dup2(fd, STDIN_FILENO) == -1) {
+            perror("Error: handleRedirection (Inline input)\ndup2");
+            close(fd);
+            return -1;
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    // Handle input redirection
+    if (inputFile != NULL) {
+        // Open the input file for reading
+        int fd = open(inputFile, O_RDONLY);
+        if (fd == -1) {
+            perror("Error: handleRedirection (Input)\nopen");
+            return -1;
+        }
+
+        // Redirect standard input to the file
+        if (dup2(fd, STDIN_FILENO) == -1) {
+            perror("Error: handleRedirection (Input)\ndup2");
+            close(fd);
+            return -1;
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    // Handle output redirection
+    if (outputFile != NULL) {
+        // Open the output file for writing
+        int fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd == -1) {
+            perror("Error: handleRedirection (Output)\nopen");
+            return -1;
+        }
+
+        // Redirect standard output to the file
+        if (dup2(fd, STDOUT_FILENO) == -1) {
+            perror("Error: handleRedirection (Output)\ndup2");
+            close(fd);
+            return -1;
+        }
+
+        // Close the file descriptor
+        close(fd);
+    }
+
+    return 0;
+}
+
+int createInlineFile(const char *data, size_t length, int newline) {
+#ifdef __linux__
+    // Anonymous memory file: the data never touches the filesystem
+    int fd = memfd_create("enseash-inline", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    // Fallback: unlinked temporary file
+    char path[] = "/tmp/enseash-inline-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd != -1) {
+        unlink(path);
+    }
+#endif
+    if (fd == -1) {
+        perror("Error: createInlineFile\nmemfd_create");
+        return -1;
+    }
+
+    // Write the data, followed by a newline for here-strings
+    const char *end = data + length;
+    while (data < end || newline) {
+        ssize_t written = data < end ? write(fd, data, (size_t) (end - data)) : write(fd, "\n", 1);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            perror("Error: createInlineFile\nwrite");
+            close(fd);
+            return -1;
+        }
+        if (data < end) {
+            data += written;
+        } else {
+            newline = 0;
+        }
+    }
+
+#ifdef __linux__
+    // Seal the content so that the command can only read it
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        perror("Error: createInlineFile\nfcntl");
+        close(fd);
+        return -1;
+    }
+#endif
+
+    // Read from the beginning
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        perror("Error: createInlineFile\nlseek");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void handlePipe(char *args[], size_t argCount) {
+    // Iterate through the arguments to check for pipe redirection
+    for (size_t i = 0; i < argCount; i++) {
+        // Meter pipe: the data goes through this process
+        if (args[i] != NULL && strcmp(args[i], "|:") == 0) {
+            args[i] = NULL;
+            runMeter(&args[0], &args[i + 1]);
+        }
+
+        if (args[i] != NULL && strcmp(args[i], "|") == 0) {
+            // Set the pipe symbol to NULL to separate the first and second command
+            args[i] = NULL;
+
+            // Split the arguments into two parts
+            char **firstCommand = &args[0];
+            char **secondCommand = &args[i + 1];
+
+            // Check for errors
+            int pipefd[2];
+            if (pipe(pipefd) == -1) {
+                fatalError("Error: handlePipe\npipe");
+            }
+
+            pid_t childPid = fork();
+            if (childPid == -1) {
+                fatalError("Error: handlePipe\nfork");
+            }
+
+            // Child process: Execute the first command before the pipe
+            else if (childPid == 0) {
+                // Close the read end of the pipe since the child writes to it
+                close(pipefd[0]);
+
+                // Redirect standard output to the write end of the pipe
+                if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
+                    perror("Error: handlePipe (firstCommand)\ndup2");
+                    close(pipefd[1]);
+                    exit(EXIT_FAILURE);
+                }
+
+                // Close the write end of the pipe as it's no longer needed
+                close(pipefd[1]);
+
+                // Apply the 'sched' prefix of the first command
+                applyScheduling(&firstCommand);
+
+                // Execute the first command using execvp
+                execvp(firstCommand[0], firstCommand);
+
+                // If execvp fails, print an error message
+                fatalError("Error: handlePipe (firstCommand)\nexecvp");
+            }
+
+            // Parent process: Execute the second command after the pipe (the shell waits for it)
+            else {
+                // Close the write end of the pipe since the parent reads from it
+                close(pipefd[1]);
+
+                // Redirect standard input to the read end of the pipe
+                if (dup2(pipefd[0], STDIN_FILENO) == -1) {
+                    perror("Error: handlePipe (secondCommand)\ndup2");
+                    close(pipefd[0]);
+                    exit(EXIT_FAILURE);
+                }
+
+                // Close the read end of the pipe as it's no longer needed
+                close(pipefd[0]);
+
+                // The second command may itself be a pipe
+                handlePipe(secondCommand, argCount - i - 1);
+
+                // Apply the 'sched' prefix of the second command
+                applyScheduling(&secondCommand);
+
+                // Execute the second command using execvp
+                execvp(secondCommand[0], secondCommand);
+
+                // If execvp fails, print an error message
+                fatalError("Error: handlePipe (secondCommand)\nexecvp");
+            }
+        }
+    }
+}
+
+
+
+// --------------------- Scheduling --------------------- //
+int parseCpuList(const char *list, cpu_set_t *cpus) {
+    // Comma-separated CPUs and ranges, such as "0,2-3"
+    CPU_ZERO(cpus);
+    while (*list != '\0') {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+        if (end == list || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET((int) cpu, cpus);
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        list = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+void applyScheduling(char ***command) {
+    char **args = *command;
+    if (args[0] == NULL || strcmp(args[0], "sched") != 0) {
+        return;
+    }
+
+    // Options until the first word that is not one
+    size_t i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i + 1] != NULL; i += 2) {
+        const char *option = args[i], *value = args[i + 1];
+
+        // CPU affinity
+        if (strcmp(option, "-c") == 0) {
+            cpu_set_t cpus;
+            if (parseCpuList(value, &cpus) == -1) {
+                writeDiagnostic("sched: invalid CPU list '%s'\n", value);
+                exit(2);
+            }
+            if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+                fatalError("Error: applyScheduling\nsched_setaffinity");
+            }
+        }
+
+        // Nice level (lowering it needs privileges)
+        else if (strcmp(option, "-n") == 0) {
+            char *end;
+            long nice = strtol(value, &end, 10);
+            if (*end != '\0' || nice < -20 || nice > 19) {
+                writeDiagnostic("sched: invalid nice level '%s'\n", value);
+                exit(2);
+            }
+            if (setpriority(PRIO_PROCESS, 0, (int) nice) == -1) {
+                fatalError("Error: applyScheduling\nsetpriority");
+            }
+        }
+
+        // Scheduling policy: batch jobs get longer time slices, idle ones only run on otherwise idle CPUs
+        else if (strcmp(option, "-p") == 0) {
+            struct sched_param parameter = { .sched_priority = 0 };
+            int policy = strcmp(value, "batch") == 0 ? SCHED_BATCH :
+                         strcmp(value, "idle") == 0  ? SCHED_IDLE :
+                         strcmp(value, "other") == 0 ? SCHED_OTHER : -1;
+            if (policy == -1) {
+                writeDiagnostic("sched: invalid policy '%s' (batch, idle or other)\n", value);
+                exit(2);
+            }
+            if (sched_setscheduler(0, policy, &parameter) == -1) {
+                fatalError("Error: applyScheduling\nsched_setscheduler");
+            }
+        }
+
+        // I/O priority: class, with a level from 0 (highest) to 7 for the realtime and best-effort classes
+        else if (strcmp(option, "-i") == 0) {
+            size_t length = strcspn(value, ":");
+            int ioClass = strncmp(value, "rt", length) == 0 && length == 2   ? IOPRIO_CLASS_RT :
+                          strncmp(value, "be", length) == 0 && length == 2   ? IOPRIO_CLASS_BE :
+                          strncmp(value, "idle", length) == 0 && length == 4 ? IOPRIO_CLASS_IDLE : -1;
+            long level = value[length] == ':' ? strtol(value + length + 1, NULL, 10) : 4;
+            if (ioClass == -1 || level < 0 || level > 7) {
+                writeDiagnostic("sched: invalid I/O priority '%s' (rt, be or idle, with :LEVEL)\n", value);
+                exit(2);
+            }
+            if (ioClass == IOPRIO_CLASS_IDLE) {
+                level = 0;
+            }
+            if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (ioClass << IOPRIO_CLASS_SHIFT) | (int) level) == -1) {
+                fatalError("Error: applyScheduling\nioprio_set");
+            }
+        }
+
+        else {
+            break;
+        }
+    }
+
+    if (args[i] == NULL || args[i][0] == '-') {
+        writeDiagnostic("usage: sched [-c CPUS] [-n NICE] [-p batch|idle|other] [-i CLASS[:LEVEL]] cmd\n");
+        exit(2);
+    }
+
+    // The command starts after the options
+    *command = &args[i];
+}
+
+
+
+// --------------------- Throughput Meter --------------------- //
+void runMeter(char **firstCommand, char **secondCommand) {
+    int input[2], output[2];
+    if (pipe(input) == -1 || pipe(output) == -1) {
+        fatalError("Error: runMeter\npipe");
+    }
+
+    // Producer: writes to the input pipe of the meter
+    pid_t producer = fork();
+    if (producer == -1) {
+        fatalError("Error: runMeter (Producer)\nfork");
+    } else if (producer == 0) {
+        if (dup2(input[1], STDOUT_FILENO) == -1) {
+            fatalError("Error: runMeter (Producer)\ndup2");
+        }
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+        applyScheduling(&firstCommand);
+        execvp(firstCommand[0], firstCommand);
+        fatalError("Error: runMeter (Producer)\nexecvp");
+    }
+
+    // Consumer: reads from the output pipe of the meter
+    pid_t consumer = fork();
+    if (consumer == -1) {
+        fatalError("Error: runMeter (Consumer)\nfork");
+    } else if (consumer == 0) {
+        if (dup2(output[0], STDIN_FILENO) == -1) {
+            fatalError("Error: runMeter (Consumer)\ndup2");
+        }
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+        applyScheduling(&secondCommand);
+        execvp(secondCommand[0], secondCommand);
+        fatalError("Error: runMeter (Consumer)\nexecvp");
+    }
+
+    // Meter: this process moves the data between the two pipes
+    close(input[1]);
+    close(output[0]);
+    signal(SIGPIPE, SIG_IGN);
+    MeterStats stats = { 0 };
+    struct timespec start, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) != 0) {
+        fatalError("Error: runMeter (Start Time)\nclock_gettime");
+    }
+    meterPipe(input[0], output[1], &stats);
+    if (clock_gettime(CLOCK_MONOTONIC, &end) != 0) {
+        fatalError("Error: runMeter (End Time)\nclock_gettime");
+    }
+
+    // Closing the pipes lets the consumer see the end of file and the producer get SIGPIPE
+    close(input[0]);
+    close(output[1]);
+    int status, producerStatus;
+    waitpid(producer, &producerStatus, 0);
+    waitpid(consumer, &status, 0);
+
+    // Report: the side the meter waited for the longest is the one keeping the other waiting
+    uint64_t microseconds = elapsedMicroseconds(&start, &end);
+    double seconds = (double) microseconds / 1e6;
+    writeDiagnostic("|: %.1f MB in %.3fs (%.1f MB/s), blocked on read %.3fs (%llu), on write %.3fs (%llu): %s\n",
+                    (double) stats.bytes / 1e6, seconds, seconds > 0 ? (double) stats.bytes / 1e6 / seconds : 0.0,
+                    (double) stats.readMicroseconds / 1e6, (unsigned long long) stats.readStalls,
+                    (double) stats.writeMicroseconds / 1e6, (unsigned long long) stats.writeStalls,
+                    stats.readMicroseconds > stats.writeMicroseconds ? "producer-bound" : "consumer-bound");
+
+    // Exit like the consumer, which is the last command of the pipe
+    flushOutput();
+    if (WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        raise(WTERMSIG(status));
+    }
+    exit(EXIT_CODE(status));
+}
+
+void meterPipe(int in, int out, MeterStats *stats) {
+    char buffer[65536];
+    int useSplice = 1;
+    struct pollfd readable = { .fd = in, .events = POLLIN };
+    struct pollfd writable = { .fd = out, .events = POLLOUT };
+
+    // Non-blocking pipes, so that every wait goes through poll and is timed
+    fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+    fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK);
+
+    while (1) {
+        // Move the data in the kernel (splice), or through a buffer if it is not supported
+        ssize_t moved;
+#ifdef __linux__
+        if (useSplice) {
+            moved = splice(in, NULL, out, NULL, sizeof(buffer), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved == -1 && errno == EINVAL) {
+                useSplice = 0;
+                continue;
+            }
+        } else
+#else
+        useSplice = 0;
+#endif
+        {
+            moved = read(in, buffer, sizeof(buffer));
+            if (moved > 0) {
+                ssize_t written = 0;
+                while (written < moved) {
+                    ssize_t result = write(out, buffer + written, (size_t) (moved - written));
+                    if (result == -1 && errno == EAGAIN) {
+                        meterWait(&writable, &stats->writeMicroseconds, &stats->writeStalls);
+                    } else if (result == -1 && errno != EINTR) {
+                        return;
+                    } else if (result > 0) {
+                        written += result;
+                    }
+                }
+            }
+        }
+
+        // Data moved
+        if (moved > 0) {
+            stats->bytes += (uint64_t) moved;
+            continue;
+        }
+
+        // End of file of the producer
+        if (moved == 0) {
+            return;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            return; // EPIPE: the consumer has exited
+        }
+
+        // Nothing moved: wait for the producer when the input is empty, otherwise the output is full
+        struct pollfd check = { .fd = in, .events = POLLIN };
+        if (poll(&check, 1, 0) == 0) {
+            meterWait(&readable, &stats->readMicroseconds, &stats->readStalls);
+        } else {
+            meterWait(&writable, &stats->writeMicroseconds, &stats->writeStalls);
+        }
+    }
+}
+
+void meterWait(struct pollfd *descriptor, uint64_t *microseconds, uint64_t *stalls) {
+    struct timespec start, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) != 0) {
+        fatalError("Error: meterWait (Start Time)\nclock_gettime");
+    }
+    while (poll(descriptor, 1, -1) == -1 && errno == EINTR) {
+    }
+    if (clock_gettime(CLOCK_MONOTONIC, &end) != 0) {
+        fatalError("Error: meterWait (End Time)\nclock_gettime");
+    }
+    *microseconds += elapsedMicroseconds(&start, &end);
+    (*stalls)++;
+}
+
+
+
+// --------------------- Here-Documents --------------------- //
+int collectHereDocuments(char *input) {
+    clearHereDocuments();
+
+    char *line = input;
+    while (*line != '\0') {
+        char *lineEnd = strchr(line, '\n');
+        if (lineEnd == NULL) {
+            lineEnd = line + strlen(line);
+        }
+
+        // Find the here-document operators of the line ('<<' but not '<<<')
+        size_t first = hereDocumentCount;
+        const char *delimiters[MAX_HERE_DOCUMENTS];
+        size_t delimiterLengths[MAX_HERE_DOCUMENTS];
+        char *c = line;
+        while ((c = findHereDocumentOperator(line, c, lineEnd)) != NULL) {
+            // The delimiter is the word after the operator
+            char *delimiter = c + 2;
+            while (*delimiter == ' ') {
+                delimiter++;
+            }
+            size_t delimiterLength = strcspn(delimiter, " \n;&|)");
+            if (delimiterLength == 0) {
+                writeDiagnostic("enseash: syntax error: missing delimiter after '<<'\n");
+                return -1;
+            }
+            if (hereDocumentCount == MAX_HERE_DOCUMENTS) {
+                writeDiagnostic("enseash: too many here-documents (maximum %d)\n", MAX_HERE_DOCUMENTS);
+                return -1;
+            }
+            hereDocuments[hereDocumentCount].operator = c;
+            delimiters[hereDocumentCount] = delimiter;
+            delimiterLengths[hereDocumentCount] = delimiterLength;
+            hereDocumentCount++;
+            c = delimiter + delimiterLength;
+        }
+
+        // The bodies follow the line, in the order of the operators
+        char *next = *lineEnd != '\0' ? lineEnd + 1 : lineEnd;
+        for (size_t i = first; i < hereDocumentCount; i++) {
+            int found = 0;
+            while (*next != '\0' && !found) {
+                char *bodyLineEnd = strchr(next, '\n');
+                size_t bodyLineLength = bodyLineEnd != NULL ? (size_t) (bodyLineEnd - next) : strlen(next);
+                char *following = bodyLineEnd != NULL ? bodyLineEnd + 1 : next + bodyLineLength;
+
+                // The body ends at the line equal to the delimiter
+                found = bodyLineLength == delimiterLengths[i] && strncmp(next, delimiters[i], bodyLineLength) == 0;
+                if (!found) {
+                    appendHereDocument(&hereDocuments[i], next, (size_t) (following - next));
+                }
+                next = following;
+            }
+
+            // In interactive mode, the body is typed after the command
+            if (!found && interactiveMode && *next == '\0') {
+                found = readHereDocument(&hereDocuments[i], delimiters[i], delimiterLengths[i]);
+            }
+            if (!found) {
+                writeDiagnostic("enseash: warning: here-document delimited by end of input (wanted '%.*s')\n",
+                                (int) delimiterLengths[i], delimiters[i]);
+            }
+        }
+
+        // Remove the bodies from the command text (the line itself does not move)
+        if (hereDocumentCount > first && *lineEnd != '\0') {
+            memmove(lineEnd + 1, next, strlen(next) + 1);
+        }
+        line = *lineEnd != '\0' ? lineEnd + 1 : lineEnd;
+    }
+    return 0;
+}
+
+char *findHereDocumentOperator(char *line, char *c, const char *lineEnd) {
+    // Comment lines (skipped by the scripts) have no here-documents
+    const char *first = line + strspn(line, " \t");
+    if (first < lineEnd && *first == '#') {
+        return NULL;
+    }
+    for (; c < lineEnd; c++) {
+        if (c[0] == '<' && c[1] == '<' && c[2] != '<' && (c == line || c[-1] != '<')) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+void appendHereDocument(HereDocument *document, const char *data, size_t length) {
+    // Grow the body geometrically
+    if (document->length + length > document->capacity) {
+        size_t capacity = document->capacity ? document->capacity : 256;
+        while (capacity < document->length + length) {
+            capacity *= 2;
+        }
+        char *body = realloc(document->body, capacity);
+        if (body == NULL) {
+            fatalError("Error: appendHereDocument\nrealloc");
+        }
+        document->body = body;
+        document->capacity = capacity;
+    }
+    memcpy(document->body + document->length, data, length);
+    document->length += length;
+}
+
+int readHereDocument(HereDocument *document, const char *delimiter, size_t delimiterLength) {
+    char line[MAX_INPUT_SIZE + 1];
+    size_t length = 0;
+    int longLine = 0; // The current line was longer than the buffer: it cannot be the delimiter
+
+    writeMessage("> ");
+    flushOutput();
+
+    // Read one byte at a time so that the input after the delimiter is left for the next prompt
+    while (1) {
+        char byte;
+        ssize_t bytesRead = read(STDIN_FILENO, &byte, 1);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            fatalError("Error: readHereDocument\nread");
+        }
+        if (bytesRead == 0) {
+            appendHereDocument(document, line, length);
+            return 0;
+        }
+
+        // Long lines are appended in pieces
+        if (byte != '\n') {
+            if (length == MAX_INPUT_SIZE) {
+                appendHereDocument(document, line, length);
+                length = 0;
+                longLine = 1;
+            }
+            line[length++] = byte;
+            continue;
+        }
+
+        // End of line: stop at the delimiter, otherwise add the line to the body
+        if (!longLine && length == delimiterLength && strncmp(line, delimiter, length) == 0) {
+            return 1;
+        }
+        line[length++] = '\n';
+        appendHereDocument(document, line, length);
+        length = 0;
+        longLine = 0;
+        writeMessage("> ");
+        flushOutput();
+    }
+}
+
+const HereDocument *findHereDocument(const char *operator) {
+    // The token returned by strtok starts at the operator
+    for (size_t i = 0; i < hereDocumentCount; i++) {
+        if (hereDocuments[i].operator == operator) {
+            return &hereDocuments[i];
+        }
+    }
+    return NULL;
+}
+
+void moveHereDocuments(const char *from, size_t length, const char *to) {
+    // The here-documents of a command copied elsewhere follow their operators into the copy
+    for (size_t i = 0; i < hereDocumentCount; i++) {
+        if (hereDocuments[i].operator >= from && hereDocuments[i].operator < from + length) {
+            hereDocuments[i].operator = to + (hereDocuments[i].operator - from);
+        }
+    }
+}
+
+void clearHereDocuments(void) {
+    // Keep the body buffers for the next input
+    for (size_t i = 0; i < hereDocumentCount; i++) {
+        hereDocuments[i].operator = NULL;
+        hereDocuments[i].length = 0;
+    }
+    hereDocumentCount = 0;
+}
+
+
+
+// --------------------- Performance Counters --------------------- //
+void openPerfCounters(pid_t pid) {
+    perfCountersValid = 0;
+
+#ifdef __linux__
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+        // Counters start disabled and are enabled when the child executes the command
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perfCounters[i].type;
+        attr.config = perfCounters[i].config;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        // Software events (context switches, page faults) are counted in the kernel
+        attr.exclude_kernel = perfCounters[i].type == PERF_TYPE_HARDWARE;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Hardware counters may be missing or forbidden (virtual machines, containers)
+        perfCounters[i].fd = (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        perfCounters[i].available = perfCounters[i].fd != -1;
+        perfCounters[i].value = 0;
+        if (perfCounters[i].available) {
+            perfCountersValid = 1;
+        }
+    }
+#else
+    (void) pid;
+#endif
+}
+
+void readPerfCounters(void) {
+    perfCountersPending = perfCountersValid;
+
+#ifdef __linux__
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (!perfCounters[i].available) {
+            continue;
+        }
+
+        // Value, time enabled and time running (the counter may have been multiplexed)
+        uint64_t values[3];
+        if (read(perfCounters[i].fd, values, sizeof(values)) != (ssize_t) sizeof(values)) {
+            perfCounters[i].available = 0;
+        } else if (values[2] > 0 && values[2] < values[1]) {
+            perfCounters[i].value = (uint64_t) ((double) values[0] * values[1] / values[2]);
+        } else {
+            perfCounters[i].value = values[0];
+        }
+
+        close(perfCounters[i].fd);
+        perfCounters[i].fd = -1;
+    }
+#endif
+}
+
+
+
+// --------------------- Latency Statistics --------------------- //
+size_t histogramIndex(uint64_t value) {
+    // Small values have their own bucket
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (size_t) value;
+    }
+
+    // Keep the HISTOGRAM_SUB_BITS bits following the most significant bit
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - HISTOGRAM_SUB_BITS;
+    size_t index = (size_t) (shift + 1) * HISTOGRAM_SUB_COUNT + (size_t) ((value >> shift) - HISTOGRAM_SUB_COUNT);
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t histogramValue(size_t index) {
+    // Middle of the range of values counted by the bucket
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return index;
+    }
+    int shift = (int) (index / HISTOGRAM_SUB_COUNT) - 1;
+    uint64_t lowest = (uint64_t) (HISTOGRAM_SUB_COUNT + index % HISTOGRAM_SUB_COUNT) << shift;
+    return lowest + ((1ULL << shift) >> 1);
+}
+
+uint64_t histogramPercentile(const CommandStats *stats, double percentile) {
+    // Find the bucket containing the requested rank
+    uint64_t rank = (uint64_t) (percentile / 100.0 * (double) stats->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t cumulated = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        cumulated += stats->buckets[i];
+        if (cumulated >= rank) {
+            uint64_t value = histogramValue(i);
+            return value < stats->maxMicroseconds ? value : stats->maxMicroseconds;
+        }
+    }
+    return stats->maxMicroseconds;
+}
+
+CommandStats *findCommandStats(const char *input) {
+    // The command name is the first word of the input
+    while (*input == ' ') {
+        input++;
+    }
+    size_t length = strcspn(input, " ");
+    if (length >= MAX_COMMAND_NAME) {
+        length = MAX_COMMAND_NAME - 1;
+    }
+    for (size_t i = 0; i < commandStatsCount; i++) {
+        if (strncmp(commandStats[i].name, input, length) == 0 && commandStats[i].name[length] == '\0') {
+            return &commandStats[i];
+        }
+    }
+    return NULL;
+}
+
+void recordCommandStats(const char *input, int status, uint64_t microseconds) {
+    // The command name is the first word of the input
+    while (*input == ' ') {
+        input++;
+    }
+    size_t length = strcspn(input, " ");
+    if (length == 0) {
+        return;
+    }
+    if (length >= MAX_COMMAND_NAME) {
+        length = MAX_COMMAND_NAME - 1;
+    }
+
+    // Find the statistics of the command, or add them
+    CommandStats *stats = findCommandStats(input);
+    if (stats == NULL) {
+        if (commandStatsCount == commandStatsCapacity) {
+            size_t capacity = commandStatsCapacity ? commandStatsCapacity * 2 : 8;
+            CommandStats *table = realloc(commandStats, capacity * sizeof(CommandStats));
+            if (table == NULL) {
+                fatalError("Error: recordCommandStats\nrealloc");
+            }
+            commandStats = table;
+            commandStatsCapacity = capacity;
+        }
+        stats = &commandStats[commandStatsCount++];
+        memset(stats, 0, sizeof(CommandStats));
+        memcpy(stats->name, input, length);
+    }
+
+    // A command fails when it exits with a non-zero code or is terminated by a signal
+    stats->count++;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        stats->failures++;
+    }
+    if (microseconds > stats->maxMicroseconds) {
+        stats->maxMicroseconds = microseconds;
+    }
+    stats->buckets[histogramIndex(microseconds)]++;
+
+    // Publish the command for external monitoring
+    publishCommandMetrics(input, length, status, microseconds);
+}
+
+void writeDuration(uint64_t microseconds) {
+    // Write a duration with a unit adapted to its magnitude
+    if (microseconds < 1000) {
+        writeFormattedMessage("%7lluus", (unsigned long long) microseconds);
+    } else if (microseconds < 1000000) {
+        writeFormattedMessage("%7.1fms", (double) microseconds / 1e3);
+    } else {
+        writeFormattedMessage("%8.2fs", (double) microseconds / 1e6);
+    }
+}
+
+void writeStatsTable(const char *format) {
+    // CSV and JSON use microseconds
+    if (strcmp(format, "csv") == 0) {
+        writeMessage("command,count,failures,p50_us,p90_us,p99_us,max_us\n");
+    } else if (strcmp(format, "json") == 0) {
+        writeMessage("[");
+    } else {
+        writeFormattedMessage("%-16s %8s %9s %9s %9s %9s %6s\n", "command", "count", "p50", "p90", "p99", "max", "fail%");
+    }
+
+    for (size_t i = 0; i < commandStatsCount; i++) {
+        const CommandStats *stats = &commandStats[i];
+        unsigned long long p50 = histogramPercentile(stats, 50.0);
+        unsigned long long p90 = histogramPercentile(stats, 90.0);
+        unsigned long long p99 = histogramPercentile(stats, 99.0);
+        unsigned long long max = stats->maxMicroseconds;
+
+        if (strcmp(format, "csv") == 0) {
+            writeFormattedMessage("%s,%llu,%llu,%llu,%llu,%llu,%llu\n", stats->name, (unsigned long long) stats->count,
+                                  (unsigned long long) stats->failures, p50, p90, p99, max);
+        } else if (strcmp(format, "json") == 0) {
+            writeFormattedMessage("%s\n  {\"command\": \"", i == 0 ? "" : ",");
+            for (const char *c = stats->name; *c != '\0'; c++) {
+                writeFormattedMessage(*c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+            }
+            writeFormattedMessage("\", \"count\": %llu, \"failures\": %llu, \"p50_us\": %llu, \"p90_us\": %llu, "
+                                  "\"p99_us\": %llu, \"max_us\": %llu}",
+                                  (unsigned long long) stats->count, (unsigned long long) stats->failures, p50, p90, p99, max);
+        } else {
+            writeFormattedMessage("%-16s %8llu ", stats->name, (unsigned long long) stats->count);
+            writeDuration(p50);
+            writeDuration(p90);
+            writeDuration(p99);
+            writeDuration(max);
+            writeFormattedMessage(" %5.1f%%\n", 100.0 * (double) stats->failures / (double) stats->count);
+        }
+    }
+
+    if (strcmp(format, "json") == 0) {
+        writeMessage(commandStatsCount > 0 ? "\n]\n" : "]\n");
+    }
+}
+
+void dumpStats(void) {
+    // Children exiting through exit() hold a stale copy of the table: only the shell dumps it
+    if (getpid() != statsOwner) {
+        return;
+    }
+
+    // Dump the table to the file named by ENSEASH_STATS, if any
+    const char *path = getenv("ENSEASH_STATS");
+    if (path == NULL || *path == '\0' || commandStatsCount == 0) {
+        return;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        perror("Error: dumpStats\nopen");
+        return;
+    }
+
+    // Reuse the output buffer, redirected to the file
+    size_t length = strlen(path);
+    flushOutputBuffer(&standardOutput);
+    standardOutput.fd = fd;
+    writeStatsTable(length > 5 && strcmp(path + length - 5, ".json") == 0 ? "json" : "csv");
+    flushOutputBuffer(&standardOutput);
+    standardOutput.fd = STDOUT_FILENO;
+    close(fd);
+}
+
+
+
+// --------------------- Builtins --------------------- //
+int isBuiltin(const char *input, const char *name) {
+    // Match the builtin name alone or followed by a space
+    size_t length = strlen(name);
+    return strncmp(input, name, length) == 0 && (input[length] == '\0' || input[length] == ' ');
+}
+
+void exitShell(int code) {
+    // Display the exit message and exit the shell
+    if (interactiveMode) {
+        writeMessage("Exiting ENSEA Shell.\n");
+    }
+    exit(code);
+}
+
+void exitBuiltin(char *input, int *status) {
+    // Skip the 'exit' word and the spaces after it
+    char *argument = input + 4;
+    while (*argument == ' ') {
+        argument++;
+    }
+
+    // Without an argument, the exit code is the one of the last command
+    int code = EXIT_CODE(*status);
+    if (*argument != '\0') {
+        char *end;
+        long value = strtol(argument, &end, 10);
+        if (*end != '\0') {
+            writeDiagnostic("exit: %s: numeric argument required\n", argument);
+            value = 2;
+        }
+        code = (int) (value & 0xff);
+    }
+    exitShell(code);
+}
+
+void execBuiltin(char *input, int *status) {
+    // Skip the 'exec' word and the spaces after it
+    char *command = input + 4;
+    while (*command == ' ') {
+        command++;
+    }
+
+    // Without a command, 'exec' does nothing
+    if (*command == '\0') {
+        *status = EXIT_STATUS(EXIT_SUCCESS);
+        return;
+    }
+
+    // Replace the shell with the command (does not return)
+    flushOutput();
+    runCommand(command);
+}
+
+
+
+void perfstatBuiltin(char *input, int *status) {
+    // Skip the 'perfstat' word and the spaces after it
+    char *argument = input + 8;
+    while (*argument == ' ') {
+        argument++;
+    }
+    *status = EXIT_STATUS(EXIT_SUCCESS);
+
+#ifdef __linux__
+    // Enable or disable the performance mode
+    if (strcmp(argument, "on") == 0 || strcmp(argument, "off") == 0) {
+        perfMode = strcmp(argument, "on") == 0;
+        perfCountersValid = 0;
+        return;
+    }
+    if (*argument != '\0') {
+        writeDiagnostic("perfstat: usage: perfstat [on|off]\n");
+        *status = EXIT_STATUS(EXIT_FAILURE);
+        return;
+    }
+
+    // Display the counters of the last command
+    if (!perfCountersValid) {
+        writeMessage(perfMode ? "perfstat: no command measured yet\n" : "perfstat: disabled (use 'perfstat on')\n");
+        return;
+    }
+    for (size_t i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (!perfCounters[i].available) {
+            writeFormattedMessage("%20s  %s\n", "not supported", perfCounters[i].description);
+        } else if (perfCounters[i].type == PERF_TYPE_SOFTWARE && perfCounters[i].config == PERF_COUNT_SW_TASK_CLOCK) {
+            writeFormattedMessage("%17.3f ms  %s\n", (double) perfCounters[i].value / 1e6, perfCounters[i].description);
+        } else {
+            writeFormattedMessage("%20llu  %s\n", (unsigned long long) perfCounters[i].value, perfCounters[i].description);
+        }
+    }
+
+    // Derived metric: instructions per cycle
+    if (perfCounters[0].available && perfCounters[1].available && perfCounters[1].value > 0) {
+        writeFormattedMessage("%20.2f  instructions per cycle\n", (double) perfCounters[0].value / perfCounters[1].value);
+    }
+#else
+    (void) argument;
+    writeDiagnostic("perfstat: performance counters are only supported on Linux\n");
+    *status = EXIT_STATUS(EXIT_FAILURE);
+#endif
+}
+
+
+
+void statsBuiltin(char *input, int *status) {
+    // Skip the 'stats' word and the spaces after it
+    char *argument = input + 5;
+    while (*argument == ' ') {
+        argument++;
+    }
+    *status = EXIT_STATUS(EXIT_SUCCESS);
+
+    // Clear the statistics of the session
+    if (strcmp(argument, "reset") == 0) {
+        commandStatsCount = 0;
+        return;
+    }
+
+    if (*argument != '\0' && strcmp(argument, "csv") != 0 && strcmp(argument, "json") != 0) {
+        writeDiagnostic("stats: usage: stats [csv|json|reset]\n");
+        *status = EXIT_STATUS(EXIT_FAILURE);
+        return;
+    }
+    if (commandStatsCount == 0 && *argument == '\0') {
+        writeMessage("stats: no command measured yet\n");
+        return;
+    }
+    writeStatsTable(argument);
+}
+
+
+
+void everyBuiltin(char *input, int *status) {
+    char *argument = input + 5;
+    uint64_t period;
+
+    // Parse the interval, then the command
+    while (*argument == ' ') {
+        argument++;
+    }
+    size_t length = strcspn(argument, " ");
+    char *command = argument + length;
+    while (*command == ' ') {
+        command++;
+    }
+    if (length == 0 || *command == '\0') {
+        writeDiagnostic("every: usage: every INTERVAL command\n");
+        *status = EXIT_STATUS(2);
+        return;
+    }
+    argument[length] = '\0';
+    if (parseDuration(argument, &period) == -1 || period == 0) {
+        writeDiagnostic("every: invalid interval '%s'\n", argument);
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    // Until interrupted by Ctrl+C
+    runPeriodically(command, 0, period, status);
+}
+
+void repeatBuiltin(char *input, int *status) {
+    char *argument = input + 6;
+    uint64_t period = 0;
+
+    // Parse the number of runs
+    while (*argument == ' ') {
+        argument++;
+    }
+    char *end;
+    unsigned long long count = strtoull(argument, &end, 10);
+    if (end == argument || *end != ' ' || count == 0) {
+        writeDiagnostic("repeat: usage: repeat COUNT [INTERVAL] command\n");
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    // The optional interval is a number followed by a unit
+    char *command = end;
+    while (*command == ' ') {
+        command++;
+    }
+    size_t length = strcspn(command, " ");
+    if (command[length] == ' ' && command[0] >= '0' && command[0] <= '9') {
+        command[length] = '\0';
+        if (parseDuration(command, &period) == -1) {
+            writeDiagnostic("repeat: invalid interval '%s'\n", command);
+            *status = EXIT_STATUS(2);
+            return;
+        }
+        command += length + 1;
+        while (*command == ' ') {
+            command++;
+        }
+    }
+    if (*command == '\0') {
+        writeDiagnostic("repeat: usage: repeat COUNT [INTERVAL] command\n");
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    runPeriodically(command, count, period, status);
+}
+
+
+
+// --------------------- Loops --------------------- //
+int keywordAt(const char *input, const char *c, const char *keyword) {
+    // The keyword must be a whole word
+    size_t length = strlen(keyword);
+    if (strncmp(c, keyword, length) != 0 || strchr(" \n;)", c[length]) == NULL) {
+        return 0;
+    }
+    if (c != input && strchr(" \n;&|(", c[-1]) == NULL) {
+        return 0;
+    }
+
+    // Command position: start of the input, after a list operator or group opener, or after 'do'
+    const char *p = c;
+    while (p > input && p[-1] == ' ') {
+        p--;
+    }
+    if (p == input || strchr("\n;&|({", p[-1]) != NULL) {
+        return 1;
+    }
+    return p - input >= 2 && strncmp(p - 2, "do", 2) == 0 && (p - 2 == input || strchr(" \n;", p[-3]) != NULL);
+}
+
+int parseLoopBody(char *list, LoopBody *body) {
+    ListElement elements[MAX_LIST_ELEMENTS];
+    size_t elementCount;
+    body->count = 0;
+    if (parseCommandList(list, elements, &elementCount) == -1) {
+        return -1;
+    }
+
+    // Simple commands are split into words once; builtins, groups and nested loops keep their text
+    for (size_t i = 0; i < elementCount; i++) {
+        LoopCommand *command = &body->commands[body->count++];
+        command->operator = elements[i].operator;
+        command->text = elements[i].command;
+        command->argCount = 0;
+        command->split = isSimpleCommand(command->text);
+        if (command->split) {
+            char *words = strdup(command->text);
+            if (words == NULL) {
+                fatalError("Error: parseLoopBody\nstrdup");
+            }
+            tokenizeInput(words, command->args, &command->argCount);
+
+            // Here-documents are found by the position of their operator in the text, like in compiled scripts
+            int hereDocument = 0;
+            for (size_t j = 0; j < command->argCount; j++) {
+                hereDocument |= strncmp(command->args[j], "<<", 2) == 0;
+            }
+            if (command->argCount == 0 || hereDocument) {
+                free(words);
+                command->split = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+void freeLoopBody(LoopBody *body) {
+    // The words of a command share the copy of its text
+    for (size_t i = 0; i < body->count; i++) {
+        if (body->commands[i].split) {
+            free(body->commands[i].args[0]);
+        }
+    }
+    body->count = 0;
+}
+
+void appendSubstituted(ByteBuffer *buffer, const char *text, const char *name, const char *value) {
+    // Replace '$name' and '${name}' with the value of the loop variable
+    size_t nameLength = name != NULL ? strlen(name) : 0;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (nameLength > 0 && c[0] == '$') {
+            int braced = c[1] == '{';
+            const char *start = c + 1 + braced;
+            const char *end = start + nameLength;
+            if (strncmp(start, name, nameLength) == 0 &&
+                (braced ? *end == '}' : !(isalnum((unsigned char) *end) || *end == '_'))) {
+                appendBytes(buffer, value, strlen(value));
+                c = end + braced - 1;
+                continue;
+            }
+        }
+        appendBytes(buffer, c, 1);
+    }
+}
+
+void runLoopBody(const LoopBody *body, const char *name, const char *value, int *status) {
+    ByteBuffer command = { 0 };
+    for (size_t i = 0; i < body->count && !interrupted; i++) {
+        const LoopCommand *loopCommand = &body->commands[i];
+
+        // '&&' and '||' decide from the status of the last command that ran
+        int succeeded = WIFEXITED(*status) && WEXITSTATUS(*status) == 0;
+        if ((loopCommand->operator == LIST_AND && !succeeded) || (loopCommand->operator == LIST_OR && succeeded)) {
+            continue;
+        }
+
+        // Other commands: substitute the variable into the text, then run the command as usual
+        command.length = 0;
+        if (!loopCommand->split) {
+            appendSubstituted(&command, loopCommand->text, name, value);
+            appendBytes(&command, "", 1);
+            executeListElement(command.data, status, 0);
+            continue;
+        }
+
+        // Simple command: substitute the variable into each word, which stays a single argument
+        size_t offsets[MAX_ARGS];
+        for (size_t j = 0; j < loopCommand->argCount; j++) {
+            offsets[j] = command.length;
+            appendSubstituted(&command, loopCommand->args[j], name, value);
+            appendBytes(&command, "", 1);
+        }
+        char *args[MAX_ARGS + 1];
+        for (size_t j = 0; j < loopCommand->argCount; j++) {
+            args[j] = command.data + offsets[j];
+        }
+        args[loopCommand->argCount] = NULL;
+
+        struct timespec start_time, end_time;
+        if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+            fatalError("Error: runLoopBody (Start Time)\nclock_gettime");
+        }
+        executeArguments(args, loopCommand->argCount, status);
+        if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+            fatalError("Error: runLoopBody (End Time)\nclock_gettime");
+        }
+        recordCommandStats(loopCommand->text, *status, elapsedMicroseconds(&start_time, &end_time));
+    }
+    free(command.data);
+}
+
+void executeLoop(char *command, int *status) {
+    int isFor = isBuiltin(command, "for");
+    char *header = command + (isFor ? 3 : 5);
+
+    // Find 'do' after the header, then the 'done' closing the body (nested loops and groups are skipped)
+    char *doWord = NULL, *doneWord = NULL;
+    int depth = 0;
+    for (char *c = header; *c != '\0' && doWord == NULL; c++) {
+        int delimiter = groupDelimiter(command, c);
+        depth += delimiter;
+        if (depth == 0 && delimiter == 0 && keywordAt(command, c, "do")) {
+            doWord = c;
+        }
+    }
+    depth = 0;
+    for (char *c = doWord != NULL ? doWord + 2 : header; *c != '\0' && doneWord == NULL; c++) {
+        depth += groupDelimiter(command, c);
+        if (depth < 0 && keywordAt(command, c, "done")) {
+            doneWord = c;
+        }
+    }
+    char *after = doneWord != NULL ? doneWord + 4 : NULL;
+    while (after != NULL && (*after == ' ' || *after == '\n')) {
+        after++;
+    }
+    if (doWord == NULL || doneWord == NULL || *after != '\0') {
+        writeDiagnostic("usage: for NAME in WORDS; do LIST; done | while LIST; do LIST; done\n");
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    // Split the header and the body in place
+    *doWord = '\0';
+    *doneWord = '\0';
+    for (char *end = doWord; end > header && strchr(" \n;", end[-1]) != NULL; end--) {
+        end[-1] = '\0';
+    }
+    char *list = doWord + 2;
+
+    // 'for NAME in WORDS': the words are split once
+    char *words[MAX_ARGS + 1];
+    size_t wordCount = 0;
+    LoopBody condition = { .count = 0 }, body = { .count = 0 };
+    if (isFor) {
+        tokenizeInput(header, words, &wordCount);
+        int valid = wordCount >= 2 && strcmp(words[1], "in") == 0 && (isalpha((unsigned char) words[0][0]) || words[0][0] == '_');
+        for (const char *c = words[0]; valid && *c != '\0'; c++) {
+            valid = isalnum((unsigned char) *c) || *c == '_';
+        }
+        if (!valid) {
+            writeDiagnostic("usage: for NAME in WORDS; do LIST; done\n");
+            *status = EXIT_STATUS(2);
+            return;
+        }
+    }
+
+    // Parse the condition and the body once for all the iterations
+    if ((!isFor && parseLoopBody(header, &condition) == -1) || parseLoopBody(list, &body) == -1) {
+        freeLoopBody(&condition);
+        *status = EXIT_STATUS(2);
+        return;
+    }
+
+    // Ctrl+C stops the loop instead of the shell (the running command is interrupted as usual)
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleInterrupt;
+    sigemptyset(&action.sa_mask);
+    interrupted = 0;
+    sigaction(SIGINT, &action, &previous);
+
+    uint64_t iterations = 0, totalMicroseconds = 0, minMicroseconds = UINT64_MAX, maxMicroseconds = 0;
+    *status = EXIT_STATUS(EXIT_SUCCESS);
+    loopDepth++;
+    while (!interrupted) {
+        struct timespec start, end;
+        if (clock_gettime(CLOCK_MONOTONIC, &start) != 0) {
+            fatalError("Error: executeLoop (Start Time)\nclock_gettime");
+        }
+
+        // Next word, or condition still true
+        if (isFor) {
+            if (iterations + 2 >= wordCount) {
+                break;
+            }
+            runLoopBody(&body, words[0], words[iterations + 2], status);
+        } else {
+            int conditionStatus = EXIT_STATUS(EXIT_SUCCESS);
+            runLoopBody(&condition, NULL, NULL, &conditionStatus);
+            if (!WIFEXITED(conditionStatus) || WEXITSTATUS(conditionStatus) != 0 || interrupted) {
+                break;
+            }
+            runLoopBody(&body, NULL, NULL, status);
+        }
+
+        if (clock_gettime(CLOCK_MONOTONIC, &end) != 0) {
+            fatalError("Error: executeLoop (End Time)\nclock_gettime");
+        }
+        uint64_t microseconds = elapsedMicroseconds(&start, &end);
+        iterations++;
+        totalMicroseconds += microseconds;
+        minMicroseconds = microseconds < minMicroseconds ? microseconds : minMicroseconds;
+        maxMicroseconds = microseconds > maxMicroseconds ? microseconds : maxMicroseconds;
+    }
+    loopDepth--;
+    sigaction(SIGINT, &previous, NULL);
+    freeLoopBody(&condition);
+    freeLoopBody(&body);
+
+    // Timing of the whole loop and of its iterations
+    if (iterations > 0 && loopDepth == 0) {
+        writeDiagnostic("%s: %llu iterations in %.1fms, min/avg/max %.1f/%.1f/%.1fms per iteration\n",
+                        isFor ? "for" : "while", (unsigned long long) iterations, (double) totalMicroseconds / 1e3,
+                        (double) minMicroseconds / 1e3, (double) totalMicroseconds / (double) iterations / 1e3,
+                        (double) maxMicroseconds / 1e3);
+    }
+}
+
+
+
+// --------------------- Output Cache --------------------- //
+void appendBytes(ByteBuffer *buffer, const void *data, size_t length) {
+    // Grow the buffer geometrically
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 256;
+        while (capacity < buffer->length + length) {
+            capacity *= 2;
+        }
+        char *bytes = realloc(buffer->data, capacity);
+        if (bytes == NULL) {
+            fatalError("Error: appendBytes\nrealloc");
+        }
+        buffer->data = bytes;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+uint64_t hashBytes(const void *data, size_t length) {
+    // 64-bit FNV-1a
+    const unsigned char *bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int cacheDirectory(char *path, size_t size) {
+    // ENSEASH_CACHE_DIR, or the user cache directory
+    const char *directory = getenv("ENSEASH_CACHE_DIR");
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (directory != NULL && *directory != '\0') {
+        snprintf(path, size, "%s", directory);
+    } else if (base != NULL && *base != '\0') {
+        snprintf(path, size, "%s/enseash", base);
+    } else if (home != NULL && *home != '\0') {
+        snprintf(path, size, "%s/.cache", home);
+        mkdir(path, S_IRWXU);
+        snprintf(path, size, "%s/.cache/enseash", home);
+    } else {
+        return -1;
+    }
+
+    // Create the directory on first use
+    if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+int buildCacheKey(char *command, ByteBuffer *key, char *outputFile, size_t size) {
+    static const char *environment[] = { "PATH", "HOME", "LANG", "LC_ALL", "LC_CTYPE", "LC_COLLATE", "LC_NUMERIC", "TZ" };
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+    *outputFile = '\0';
+
+    // Tokenize a copy: here-documents are found by the address of their token in the command
+    char *copy = strdup(command);
+    if (copy == NULL) {
+        fatalError("Error: buildCacheKey\nstrdup");
+    }
+    tokenizeInput(copy, args, &argCount);
+
+    // Command words, with the identity of the files read through '<'
+    for (size_t i = 0; i < argCount; i++) {
+        char *original = command + (args[i] - copy);
+        if (strcmp(args[i], ">") == 0 && i + 1 < argCount) {
+            // The output file is written by the cache, not by the command
+            snprintf(outputFile, size, "%s", args[i + 1]);
+            memset(original, ' ', (size_t) (args[i + 1] + strlen(args[i + 1]) - args[i]));
+            i++;
+            continue;
+        }
+
+        appendBytes(key, args[i], strlen(args[i]) + 1);
+        if (strcmp(args[i], "<") == 0 && i + 1 < argCount) {
+            struct stat info;
+            if (stat(args[i + 1], &info) == -1) {
+                free(copy);
+                return -1;
+            }
+            uint64_t identity[5] = { (uint64_t) info.st_dev, (uint64_t) info.st_ino, (uint64_t) info.st_size,
+                                     (uint64_t) info.st_mtim.tv_sec, (uint64_t) info.st_mtim.tv_nsec };
+            appendBytes(key, identity, sizeof(identity));
+        } else if (strncmp(args[i], "<<", 2) == 0 && strncmp(args[i], "<<<", 3) != 0) {
+            const HereDocument *document = findHereDocument(original);
+            uint64_t identity[2] = { 0, 0 };
+            if (document != NULL && document->body != NULL) {
+                identity[0] = hashBytes(document->body, document->length);
+                identity[1] = document->length;
+            }
+            appendBytes(key, identity, sizeof(identity));
+        }
+    }
+    free(copy);
+
+    // Working directory and environment variables that change the output of most commands
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        appendBytes(key, cwd, strlen(cwd) + 1);
+    }
+    for (size_t i = 0; i < sizeof(environment) / sizeof(environment[0]); i++) {
+        const char *value = getenv(environment[i]);
+        appendBytes(key, environment[i], strlen(environment[i]));
+        appendBytes(key, "=", 1);
+        appendBytes(key, value != NULL ? value : "", value != NULL ? strlen(value) + 1 : 1);
+    }
+
+    // Additional variables named in ENSEASH_CACHE_ENV (separated by spaces or colons)
+    const char *names = getenv("ENSEASH_CACHE_ENV");
+    while (names != NULL && *names != '\0') {
+        size_t length = strcspn(names, " :");
+        if (length > 0 && length < 256) {
+            char name[256];
+            memcpy(name, names, length);
+            name[length] = '\0';
+            const char *value = getenv(name);
+            appendBytes(key, name, length);
+            appendBytes(key, "=", 1);
+            appendBytes(key, value != NULL ? value : "", value != NULL ? strlen(value) + 1 : 1);
+        }
+        names += length + (names[length] != '\0');
+    }
+    return 0;
+}
+
+int readCacheEntry(const char *path, const ByteBuffer *key, ByteBuffer *output, int *exitCode) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // The stored key must match exactly (the file name is only its hash)
+    CacheHeader header;
+    int valid = read(fd, &header, sizeof(header)) == (ssize_t) sizeof(header) &&
+                memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0 && header.keyLength == key->length;
+    char *storedKey = valid ? malloc(header.keyLength + 1) : NULL;
+    valid = valid && storedKey != NULL && read(fd, storedKey, header.keyLength) == (ssize_t) header.keyLength &&
+            memcmp(storedKey, key->data, key->length) == 0;
+    free(storedKey);
+
+    // Read the output
+    if (valid) {
+        char chunk[65536];
+        ssize_t bytesRead;
+        while ((bytesRead = read(fd, chunk, sizeof(chunk))) > 0) {
+            appendBytes(output, chunk, (size_t) bytesRead);
+        }
+        valid = bytesRead == 0 && output->length == header.outputLength;
+        *exitCode = (int) header.exitCode;
+
+        // Mark the entry as recently used for the LRU eviction
+        futimens(fd, NULL);
+    }
+    close(fd);
+    return valid ? 0 : -1;
+}
+
+void writeCacheEntry(const char *path, const ByteBuffer *key, const ByteBuffer *output, int exitCode) {
+    // Write a temporary file, then rename it so that readers never see a partial entry
+    char temporary[4200];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int) getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.keyLength = (uint32_t) key->length;
+    header.exitCode = (uint32_t) exitCode;
+    header.outputLength = output->length;
+    struct iovec iov[3] = {
+        { &header, sizeof(header) },
+        { key->data, key->length },
+        { output->data, output->length },
+    };
+    ssize_t expected = (ssize_t) (sizeof(header) + key->length + output->length);
+    int written = writev(fd, iov, 3) == expected;
+    close(fd);
+    if (!written || rename(temporary, path) == -1) {
+        unlink(temporary);
+        return;
+    }
+    cacheStats.stores++;
+}
+
+void evictCacheEntries(const char *directory) {
+    // Size limit from ENSEASH_CACHE_SIZE (bytes, or with a K, M or G suffix)
+    uint64_t limit = DEFAULT_CACHE_SIZE;
+    const char *size = getenv("ENSEASH_CACHE_SIZE");
+    if (size != NULL && *size != '\0') {
+        char *unit;
+        limit = strtoull(size, &unit, 10);
+        limit <<= *unit == 'K' ? 10 : *unit == 'M' ? 20 : *unit == 'G' ? 30 : 0;
+    }
+
+    // List the entries with their size and last use
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        return;
+    }
+    struct {
+        char name[64];
+        uint64_t size;
+        struct timespec used;
+    } *entries = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[4200];
+        struct stat info;
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (strlen(entry->d_name) != 32 || stat(path, &info) == -1 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            void *grown = realloc(entries, capacity * sizeof(*entries));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+        snprintf(entries[count].name, sizeof(entries[count].name), "%s", entry->d_name);
+        entries[count].size = (uint64_t) info.st_size;
+        entries[count].used = info.st_mtim;
+        total += (uint64_t) info.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    // Remove the least recently used entries until the cache fits
+    while (total > limit && count > 0) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < count; i++) {
+            if (entries[i].used.tv_sec < entries[oldest].used.tv_sec ||
+                (entries[i].used.tv_sec == entries[oldest].used.tv_sec &&
+                 entries[i].used.tv_nsec < entries[oldest].used.tv_nsec)) {
+                oldest = i;
+            }
+        }
+        char path[4200];
+        snprintf(path, sizeof(path), "%s/%s", directory, entries[oldest].name);
+        if (unlink(path) == 0) {
+            cacheStats.evictions++;
+        }
+        total -= entries[oldest].size;
+        entries[oldest] = entries[--count];
+    }
+    free(entries);
+}
+
+void captureCommand(char *command, int fd, ByteBuffer *output, int *status) {
+    // The command writes to a pipe read by the shell
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        fatalError("Error: captureCommand\npipe");
+    }
+    flushOutput();
+    int savedOutput = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (savedOutput == -1 || dup2(pipefd[1], STDOUT_FILENO) == -1) {
+        fatalError("Error: captureCommand\ndup2");
+    }
+    close(pipefd[1]);
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    pid_t pid = startCommand(command);
+    if (dup2(savedOutput, STDOUT_FILENO) == -1) {
+        fatalError("Error: captureCommand\ndup2");
+    }
+    close(savedOutput);
+
+    // Copy the output to its destination while keeping it for the cache
+    char chunk[65536];
+    ssize_t bytesRead;
+    while ((bytesRead = read(pipefd[0], chunk, sizeof(chunk))) != 0) {
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        appendBytes(output, chunk, (size_t) bytesRead);
+        writeAll(fd, chunk, (size_t) bytesRead);
+    }
+    close(pipefd[0]);
+    waitCommand(pid, status);
+}
+
+void writeAll(int fd, const char *data, size_t length) {
+    // Write everything, resuming after partial writes
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += written;
+        length -= (size_t) written;
+    }
+}
+
+void cachedBuiltin(char *input, int *status) {
+    // Skip the 'cached' word and the spaces after it
+    char *command = input + 6;
+    while (*command == ' ') {
+        command++;
+    }
+    *status = EXIT_STATUS(EXIT_SUCCESS);
+
+    // Without a command, display the hit/miss report
+    if (*command == '\0') {
+        uint64_t lookups = cacheStats.hits + cacheStats.misses;
+        writeFormattedMessage("cache: %llu hits, %llu misses (%.1f%% hit rate), %llu stored, %llu evicted, %.1fms saved\n",
+                              (unsigned long long) cacheStats.hits, (unsigned long long) cacheStats.misses,
+                              lookups > 0 ? 100.0 * (double) cacheStats.hits / (double) lookups : 0.0,
+                              (unsigned long long) cacheStats.stores, (unsigned long long) cacheStats.evictions,
+                              (double) cacheStats.savedMicroseconds / 1e3);
+        return;
+    }
+
+    // Key of the command (words, input files, working directory and environment)
+    ByteBuffer key = { 0 }, output = { 0 };
+    char outputFile[4096];
+    char directory[4096], path[4200];
+    int cacheable = buildCacheKey(command, &key, outputFile, sizeof(outputFile)) == 0 && cacheDirectory(directory, sizeof(directory)) == 0;
+    if (cacheable) {
+        uint64_t first = hashBytes(key.data, key.length);
+        uint64_t second = hashBytes(&first, sizeof(first)) ^ key.length;
+        snprintf(path, sizeof(path), "%s/%016llx%016llx", directory, (unsigned long long) first,
+                 (unsigned long long) second);
+    }
+
+    // Destination of the output: the '>' file of the command, or the standard output
+    flushOutput();
+    int fd = STDOUT_FILENO;
+    if (*outputFile != '\0') {
+        fd = open(outputFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd == -1) {
+            perror("Error: cachedBuiltin\nopen");
+            *status = EXIT_STATUS(EXIT_FAILURE);
+            free(key.data);
+            return;
+        }
+    }
+
+    // Hit: replay the stored output and exit status without running the command
+    int exitCode;
+    if (cacheable && readCacheEntry(path, &key, &output, &exitCode) == 0) {
+        writeAll(fd, output.data, output.length);
+        *status = EXIT_STATUS(exitCode);
+        cacheStats.hits++;
+        const CommandStats *stats = findCommandStats(command);
+        if (stats != NULL && stats->count > 0) {
+            cacheStats.savedMicroseconds += histogramPercentile(stats, 50.0);
+        }
+    }
+
+    // Miss: run the command, then store its output if it exited normally
+    else {
+        struct timespec start_time, end_time;
+        output.length = 0;
+        cacheStats.misses++;
+        if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+            fatalError("Error: cachedBuiltin (Start Time)\nclock_gettime");
+        }
+        captureCommand(command, fd, &output, status);
+        if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+            fatalError("Error: cachedBuiltin (End Time)\nclock_gettime");
+        }
+        recordCommandStats(command, *status, elapsedMicroseconds(&start_time, &end_time));
+        if (cacheable && WIFEXITED(*status)) {
+            writeCacheEntry(path, &key, &output, WEXITSTATUS(*status));
+            evictCacheEntries(directory);
+        }
+    }
+
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    free(key.data);
+    free(output.data);
+}
+
+
+
+// --------------------- Periodic Execution --------------------- //
+int parseDuration(const char *text, uint64_t *nanoseconds) {
+    // Number followed by an optional unit (seconds by default)
+    char *unit;
+    double value = strtod(text, &unit);
+    if (unit == text || value < 0) {
+        return -1;
+    }
+
+    double scale;
+    if (strcmp(unit, "") == 0 || strcmp(unit, "s") == 0) {
+        scale = 1e9;
+    } else if (strcmp(unit, "ms") == 0) {
+        scale = 1e6;
+    } else if (strcmp(unit, "us") == 0) {
+        scale = 1e3;
+    } else if (strcmp(unit, "m") == 0) {
+        scale = 60e9;
+    } else {
+        return -1;
+    }
+    *nanoseconds = (uint64_t) (value * scale);
+    return 0;
+}
+
+void runPeriodically(const char *command, uint64_t count, uint64_t period, int *status) {
+    // The list is parsed in place, so each run works on a fresh copy
+    size_t length = strlen(command);
+    char *copy = malloc(length + 1);
+    if (copy == NULL) {
+        fatalError("Error: runPeriodically\nmalloc");
+    }
+    moveHereDocuments(command, length, copy);
+
+    // Ctrl+C stops the loop instead of the shell (the running command is interrupted as usual)
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleInterrupt;
+    sigemptyset(&action.sa_mask);
+    interrupted = 0;
+    sigaction(SIGINT, &action, &previous);
+
+    // Deadlines are absolute: start + k * period
+    struct timespec origin;
+    if (clock_gettime(CLOCK_MONOTONIC, &origin) != 0) {
+        fatalError("Error: runPeriodically\nclock_gettime");
+    }
+    uint64_t tick = 0, runs = 0, failures = 0, overruns = 0;
+    uint64_t totalMicroseconds = 0, minMicroseconds = UINT64_MAX, maxMicroseconds = 0, maxLagMicroseconds = 0;
+
+    while (!interrupted && (count == 0 || runs < count)) {
+        struct timespec deadline = origin, start, end;
+        uint64_t offset = tick * period;
+        deadline.tv_sec += (time_t) (offset / 1000000000ULL);
+        deadline.tv_nsec += (long) (offset % 1000000000ULL);
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        // Sleep until the deadline (interrupted by Ctrl+C)
+        if (period > 0) {
+            flushOutput();
+            int error;
+            while ((error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) == EINTR && !interrupted) {
+            }
+            if (interrupted) {
+                break;
+            }
+        }
+
+        // Run the command
+        if (clock_gettime(CLOCK_MONOTONIC, &start) != 0) {
+            fatalError("Error: runPeriodically (Start Time)\nclock_gettime");
+        }
+        memcpy(copy, command, length + 1);
+        executeCommandList(copy, status, 0);
+        if (clock_gettime(CLOCK_MONOTONIC, &end) != 0) {
+            fatalError("Error: runPeriodically (End Time)\nclock_gettime");
+        }
+
+        // Update the running statistics
+        uint64_t microseconds = elapsedMicroseconds(&start, &end);
+        uint64_t lag = period > 0 ? elapsedMicroseconds(&deadline, &start) : 0;
+        runs++;
+        if (!WIFEXITED(*status) || WEXITSTATUS(*status) != 0) {
+            failures++;
+        }
+        totalMicroseconds += microseconds;
+        minMicroseconds = microseconds < minMicroseconds ? microseconds : minMicroseconds;
+        maxMicroseconds = microseconds > maxMicroseconds ? microseconds : maxMicroseconds;
+        maxLagMicroseconds = lag > maxLagMicroseconds ? lag : maxLagMicroseconds;
+
+        // Next deadline: skip the ones already missed by an overrun
+        tick++;
+        uint64_t elapsedNanoseconds = elapsedMicroseconds(&origin, &end) * 1000;
+        int overrun = period > 0 && elapsedNanoseconds > tick * period;
+        if (overrun) {
+            overruns++;
+            tick = elapsedNanoseconds / period + 1;
+        }
+
+        // Status line of the run
+        int signaled = WIFSIGNALED(*status);
+        writeFormattedMessage("#%llu [%s:%d|%.1fms] avg %.1fms max %.1fms%s\n", (unsigned long long) runs,
+                              signaled ? "sign" : "exit", signaled ? WTERMSIG(*status) : WEXITSTATUS(*status),
+                              (double) microseconds / 1e3, (double) totalMicroseconds / (double) runs / 1e3,
+                              (double) maxMicroseconds / 1e3, overrun ? " (overrun)" : "");
+    }
+
+    sigaction(SIGINT, &previous, NULL);
+    moveHereDocuments(copy, length, command);
+    free(copy);
+
+    // Summary of the whole execution
+    if (runs > 0) {
+        writeFormattedMessage("%llu runs, %llu failed, %llu overruns, min/avg/max %.1f/%.1f/%.1fms, max start lag %.3fms\n",
+                              (unsigned long long) runs, (unsigned long long) failures, (unsigned long long) overruns,
+                              (double) minMicroseconds / 1e3, (double) totalMicroseconds / (double) runs / 1e3,
+                              (double) maxMicroseconds / 1e3, (double) maxLagMicroseconds / 1e3);
+    }
+}
+
+void handleInterrupt(int signal) {
+    (void) signal;
+    interrupted = 1;
+}
+
+
+
+// --------------------- Session Record --------------------- //
+void openSessionRecord(const char *path) {
+    sessionRecordFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (sessionRecordFd == -1) {
+        fatalError("Error: openSessionRecord\nopen");
+    }
+    if (clock_gettime(CLOCK_MONOTONIC, &sessionStart) != 0) {
+        fatalError("Error: openSessionRecord\nclock_gettime");
+    }
+
+    // The header keeps the wall-clock start of the session
+    char header[64];
+    int length = snprintf(header, sizeof(header), "# enseash session %lld\n", (long long) time(NULL));
+    writeAll(sessionRecordFd, header, (size_t) length);
+}
+
+void recordSessionLine(const char *line, const struct timespec *start, int status, uint64_t microseconds) {
+    // Line format: offset from the session start, exit code and execution time in microseconds, then the input
+    char record[3 * MAX_INPUT_SIZE + 64];
+    int length = snprintf(record, sizeof(record), "%llu\t%d\t%llu\t",
+                          (unsigned long long) elapsedMicroseconds(&sessionStart, start), EXIT_CODE(status),
+                          (unsigned long long) microseconds);
+
+    // Escape the characters that delimit the fields and the records
+    for (const char *c = line; *c != '\0' && (size_t) length < sizeof(record) - 3; c++) {
+        if (*c == '\\' || *c == '\n' || *c == '\t') {
+            record[length++] = '\\';
+            record[length++] = *c == '\n' ? 'n' : *c == '\t' ? 't' : '\\';
+        } else {
+            record[length++] = *c;
+        }
+    }
+    record[length++] = '\n';
+
+    // A single write per line, so the log stays usable if the shell is killed
+    writeAll(sessionRecordFd, record, (size_t) length);
+}
+
+int parseSessionLine(char *line, ReplayLine *replayLine) {
+    unsigned long long offset, microseconds;
+    int exitCode, consumed;
+    if (sscanf(line, "%llu\t%d\t%llu\t%n", &offset, &exitCode, &microseconds, &consumed) != 3) {
+        return -1;
+    }
+    replayLine->offset = offset;
+    replayLine->recordedExitCode = exitCode;
+    replayLine->recordedMicroseconds = microseconds;
+
+    // Unescape the input in place
+    char *command = line + consumed;
+    size_t length = 0;
+    for (char *c = command; *c != '\0' && *c != '\n'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+            command[length++] = *c == 'n' ? '\n' : *c == 't' ? '\t' : *c;
+        } else {
+            command[length++] = *c;
+        }
+    }
+    command[length] = '\0';
+    replayLine->command = strdup(command);
+    if (replayLine->command == NULL) {
+        fatalError("Error: parseSessionLine\nstrdup");
+    }
+    return 0;
+}
+
+void replaySession(const char *path, int fast, double threshold) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fatalError("Error: replaySession\nfopen");
+    }
+
+    // Load the whole session before running it
+    ReplayLine *lines = NULL;
+    size_t lineCount = 0, lineCapacity = 0;
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, file) != -1) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (lineCount == lineCapacity) {
+            lineCapacity = lineCapacity ? lineCapacity * 2 : 64;
+            ReplayLine *grown = realloc(lines, lineCapacity * sizeof(ReplayLine));
+            if (grown == NULL) {
+                fatalError("Error: replaySession\nrealloc");
+            }
+            lines = grown;
+        }
+        if (parseSessionLine(line, &lines[lineCount]) == 0) {
+            lineCount++;
+        }
+    }
+    free(line);
+    fclose(file);
+
+    // Run each line, at its original offset unless running as fast as possible
+    struct timespec origin;
+    if (clock_gettime(CLOCK_MONOTONIC, &origin) != 0) {
+        fatalError("Error: replaySession\nclock_gettime");
+    }
+    size_t replayed = 0;
+    for (; replayed < lineCount; replayed++) {
+        ReplayLine *replayLine = &lines[replayed];
+        const char *command = replayLine->command;
+        while (*command == ' ') {
+            command++;
+        }
+
+        // The session ended with 'exit'
+        if (isBuiltin(command, "exit")) {
+            break;
+        }
+
+        if (!fast) {
+            struct timespec deadline = origin;
+            deadline.tv_sec += (time_t) (replayLine->offset / 1000000ULL);
+            deadline.tv_nsec += (long) (replayLine->offset % 1000000ULL) * 1000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            flushOutput();
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+            }
+        }
+
+        // Same timing as the interactive loop: here-documents are read from the line itself
+        char *copy = strdup(replayLine->command);
+        if (copy == NULL) {
+            fatalError("Error: replaySession\nstrdup");
+        }
+        struct timespec start, end;
+        int status = EXIT_STATUS(EXIT_SUCCESS);
+        if (clock_gettime(CLOCK_MONOTONIC, &start) != 0) {
+            fatalError("Error: replaySession (Start Time)\nclock_gettime");
+        }
+        if (collectHereDocuments(copy) == -1) {
+            status = EXIT_STATUS(2);
+        } else {
+            executeCommandList(copy, &status, 0);
+        }
+        if (clock_gettime(CLOCK_MONOTONIC, &end) != 0) {
+            fatalError("Error: replaySession (End Time)\nclock_gettime");
+        }
+        free(copy);
+        replayLine->replayedMicroseconds = elapsedMicroseconds(&start, &end);
+        replayLine->replayedExitCode = EXIT_CODE(status);
+    }
+
+    // Latency diff against the recording: a regression is slower by more than the threshold (and 1ms)
+    uint64_t recordedTotal = 0, replayedTotal = 0;
+    size_t regressions = 0;
+    writeDiagnostic("%10s %10s %8s  %s\n", "recorded", "replayed", "diff", "command");
+    for (size_t i = 0; i < replayed; i++) {
+        const ReplayLine *replayLine = &lines[i];
+        double recorded = (double) replayLine->recordedMicroseconds;
+        double current = (double) replayLine->replayedMicroseconds;
+        double difference = recorded > 0 ? 100.0 * (current - recorded) / recorded : 0.0;
+        int regression = difference > threshold && current - recorded > 1000.0;
+        int changed = replayLine->recordedExitCode != replayLine->replayedExitCode;
+        regressions += regression;
+        recordedTotal += replayLine->recordedMicroseconds;
+        replayedTotal += replayLine->replayedMicroseconds;
+
+        char command[41];
+        snprintf(command, sizeof(command), "%s", replayLine->command);
+        for (char *c = command; *c != '\0'; c++) {
+            *c = *c == '\n' ? ';' : *c;
+        }
+        writeDiagnostic("%8.1fms %8.1fms %+7.1f%%  %s%s", recorded / 1e3, current / 1e3, difference, command,
+                        regression ? "  REGRESSION" : "");
+        if (changed) {
+            writeDiagnostic("  (exit %d -> %d)", replayLine->recordedExitCode, replayLine->replayedExitCode);
+        }
+        writeDiagnostic("\n");
+    }
+    writeDiagnostic("replay: %zu commands, recorded %.1fms, replayed %.1fms (%+.1f%%), %zu regressions above %.0f%%\n",
+                    replayed, (double) recordedTotal / 1e3, (double) replayedTotal / 1e3,
+                    recordedTotal > 0 ? 100.0 * ((double) replayedTotal - (double) recordedTotal) / (double) recordedTotal : 0.0,
+                    regressions, threshold);
+
+    for (size_t i = 0; i < lineCount; i++) {
+        free(lines[i].command);
+    }
+    free(lines);
+
+    // The exit code tells scripts whether the new build regressed
+    exit(regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+
+
+// --------------------- Metrics Ring --------------------- //
+void openMetricsRing(void) {
+    // Segment name from ENSEASH_METRICS: a name starting with '/', or one per shell
+    const char *name = getenv("ENSEASH_METRICS");
+    if (name == NULL || *name == '\0') {
+        return;
+    }
+    if (*name == '/') {
+        snprintf(metricsName, sizeof(metricsName), "%s", name);
+    } else {
+        snprintf(metricsName, sizeof(metricsName), "/enseash-%d", (int) getpid());
+    }
+
+    // Create the segment (in /dev/shm) and map it
+    int fd = shm_open(metricsName, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        fatalError("Error: openMetricsRing\nshm_open");
+    }
+    if (ftruncate(fd, sizeof(MetricsRing)) == -1) {
+        fatalError("Error: openMetricsRing\nftruncate");
+    }
+    MetricsRing *ring = mmap(NULL, sizeof(MetricsRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        fatalError("Error: openMetricsRing\nmmap");
+    }
+    close(fd);
+
+    // The magic number is written last: readers ignore the segment until it is initialized
+    ring->version = METRICS_VERSION;
+    ring->slotCount = METRICS_SLOTS;
+    ring->pid = (int32_t) getpid();
+    for (size_t i = 0; i < METRICS_BUCKETS; i++) {
+        ring->bucketBounds[i] = metricsBucketBounds[i];
+    }
+    __atomic_store_n(&ring->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    metricsRing = ring;
+    metricsOwner = getpid();
+    atexit(closeMetricsRing);
+}
+
+void publishCommandMetrics(const char *name, size_t length, int status, uint64_t microseconds) {
+    // Only the shell publishes (single producer), not the subshells and substitutions it forks
+    MetricsRing *ring = metricsRing;
+    if (ring == NULL || getpid() != metricsOwner) {
+        return;
+    }
+
+    // Seqlock: the sequence is odd while the slot is written, readers retry when it changed
+    uint64_t index = ring->head;
+    MetricsRecord *record = &ring->slots[index & (METRICS_SLOTS - 1)];
+    uint32_t sequence = record->sequence;
+    __atomic_store_n(&record->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->index = index;
+    record->timestamp = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    record->elapsedMicroseconds = microseconds;
+    record->exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    record->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    record->userMicroseconds = (uint64_t) commandUsage.ru_utime.tv_sec * 1000000 + (uint64_t) commandUsage.ru_utime.tv_usec;
+    record->systemMicroseconds = (uint64_t) commandUsage.ru_stime.tv_sec * 1000000 + (uint64_t) commandUsage.ru_stime.tv_usec;
+    record->maxResidentKilobytes = (uint64_t) commandUsage.ru_maxrss;
+    record->minorFaults = (uint64_t) commandUsage.ru_minflt;
+    record->majorFaults = (uint64_t) commandUsage.ru_majflt;
+    record->voluntarySwitches = (uint64_t) commandUsage.ru_nvcsw;
+    record->involuntarySwitches = (uint64_t) commandUsage.ru_nivcsw;
+    memset(record->name, 0, sizeof(record->name));
+    memcpy(record->name, name, length < sizeof(record->name) ? length : sizeof(record->name) - 1);
+
+    __atomic_store_n(&record->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    // Cumulative counters (single writer: plain increments published with release stores)
+    size_t bucket = 0;
+    while (bucket < METRICS_BUCKETS && microseconds > metricsBucketBounds[bucket]) {
+        bucket++;
+    }
+    __atomic_store_n(&ring->buckets[bucket], ring->buckets[bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->failures, ring->failures + (record->exitCode != 0), __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->elapsedMicroseconds, ring->elapsedMicroseconds + microseconds, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->userMicroseconds, ring->userMicroseconds + record->userMicroseconds, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->systemMicroseconds, ring->systemMicroseconds + record->systemMicroseconds, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, index + 1, __ATOMIC_RELEASE);
+}
+
+void closeMetricsRing(void) {
+    // Children exiting through exit() must not remove the segment of the shell
+    if (metricsRing != NULL && getpid() == metricsOwner) {
+        shm_unlink(metricsName);
+    }
+}
+
+
+
+// --------------------- Scripts --------------------- //
+char *readScript(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    // Read the whole script, terminated by a null byte
+    ByteBuffer script = { 0 };
+    char chunk[65536];
+    ssize_t bytesRead;
+    while ((bytesRead = read(fd, chunk, sizeof(chunk))) > 0) {
+        appendBytes(&script, chunk, (size_t) bytesRead);
+    }
+    close(fd);
+    if (bytesRead < 0) {
+        free(script.data);
+        return NULL;
+    }
+    *length = script.length;
+    appendBytes(&script, "", 1);
+    return script.data;
+}
+
+char *nextStatement(char *script, char **cursor) {
+    char *start = *cursor;
+
+    // Skip blank lines and comments (including the '#!' line)
+    while (1) {
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        if (*start == '#') {
+            start += strcspn(start, "\n");
+        }
+        if (*start != '\n') {
+            break;
+        }
+        start++;
+    }
+    if (*start == '\0') {
+        return NULL;
+    }
+
+    // A statement ends with its line, unless a group is open or the line ends with '&&' or '||'
+    int depth = 0;
+    char *c = start;
+    for (; *c != '\0'; c++) {
+        depth += groupDelimiter(script, c);
+        if (*c == '\n' && depth <= 0) {
+            char *end = c;
+            while (end > start && end[-1] == ' ') {
+                end--;
+            }
+            if (end - start < 2 || !((end[-2] == '&' && end[-1] == '&') || (end[-2] == '|' && end[-1] == '|'))) {
+                break;
+            }
+        }
+    }
+    *cursor = *c != '\0' ? c + 1 : c;
+    *c = '\0';
+    return start;
+}
+
+void runScript(const char *path) {
+    // The compiled script is used when it still matches the source
+    struct stat sourceInfo;
+    if (stat(path, &sourceInfo) == -1) {
+        writeDiagnostic("enseash: %s: %s\n", path, strerror(errno));
+        exit(127);
+    }
+    char compiledPath[4096];
+    snprintf(compiledPath, sizeof(compiledPath), "%s%s", path, COMPILED_SUFFIX);
+    char *script = NULL;
+    size_t length = 0;
+    size_t size;
+    const CompiledHeader *image = loadCompiledScript(compiledPath, path, &sourceInfo, &script, &length, &size);
+    if (image != NULL) {
+        free(script);
+        runCompiledScript(image);
+    }
+
+    // Fallback: run the source
+    if (script == NULL) {
+        script = readScript(path, &length);
+        if (script == NULL) {
+            writeDiagnostic("enseash: %s: %s\n", path, strerror(errno));
+            exit(127);
+        }
+    }
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+    if (collectHereDocuments(script) == -1) {
+        exit(2);
+    }
+    char *cursor = script;
+    char *statement;
+    while ((statement = nextStatement(script, &cursor)) != NULL) {
+        executeCommandList(statement, &status, 0);
+    }
+    exit(EXIT_CODE(status));
+}
+
+
+
+// --------------------- Compiled Scripts --------------------- //
+uint32_t appendString(ByteBuffer *strings, const char *text) {
+    // Offsets start after the header, so that 0 means no string
+    uint32_t offset = (uint32_t) strings->length;
+    appendBytes(strings, text, strlen(text) + 1);
+    return offset;
+}
+
+int isSimpleCommand(char *command) {
+    static const char *builtins[] = { "exit", "exec", "perfstat", "stats", "cached", "every", "repeat" };
+
+    // The shell runs the builtins, groups and loops itself, and is needed after some commands
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (isBuiltin(command, builtins[i])) {
+            return 0;
+        }
+    }
+    if (*command == '(' || groupDelimiter(command, command) == 1 || hasProcessSubstitution(command)) {
+        return 0;
+    }
+    return 1;
+}
+
+int compileElement(char *command, CompiledElement *element, ByteBuffer *stages, ByteBuffer *words, ByteBuffer *strings) {
+    element->precompiled = 0;
+    element->text = appendString(strings, command);
+    element->inputFile = COMPILED_NONE;
+    element->outputFile = COMPILED_NONE;
+    element->stageCount = 0;
+    element->firstStage = (uint32_t) (stages->length / sizeof(CompiledStage));
+
+    // Builtins, groups and process substitutions keep their source text
+    if (!isSimpleCommand(command)) {
+        return 0;
+    }
+
+    // Split the words into stages and redirections
+    char *args[MAX_ARGS + 1];
+    size_t argCount = 0;
+    tokenizeInput(command, args, &argCount);
+    CompiledStage stage = { (uint32_t) (words->length / sizeof(uint32_t)), 0 };
+    for (size_t i = 0; i < argCount; i++) {
+        if (strncmp(args[i], "<<", 2) == 0 || strcmp(args[i], "|:") == 0) {
+            return 0;
+        } else if ((strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0) && i + 1 < argCount) {
+            uint32_t *file = args[i][0] == '<' ? &element->inputFile : &element->outputFile;
+            *file = appendString(strings, args[++i]);
+        } else if (strcmp(args[i], "|") == 0) {
+            if (stage.wordCount == 0) {
+                return 0;
+            }
+            appendBytes(stages, &stage, sizeof(stage));
+            element->stageCount++;
+            stage.firstWord = (uint32_t) (words->length / sizeof(uint32_t));
+            stage.wordCount = 0;
+        } else {
+            uint32_t word = appendString(strings, args[i]);
+            appendBytes(words, &word, sizeof(word));
+            stage.wordCount++;
+        }
+    }
+    if (stage.wordCount == 0) {
+        return 0;
+    }
+    appendBytes(stages, &stage, sizeof(stage));
+    element->stageCount++;
+    element->precompiled = 1;
+    return 1;
+}
+
+void compileScript(const char *path) {
+    struct stat sourceInfo;
+    size_t length;
+    char *script = readScript(path, &length);
+    if (script == NULL || stat(path, &sourceInfo) == -1) {
+        writeDiagnostic("enseash: %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // The body of a here-document is not part of its command: such scripts run from the source
+    for (char *line = script; *line != '\0';) {
+        char *lineEnd = line + strcspn(line, "\n");
+        if (findHereDocumentOperator(line, line, lineEnd) != NULL) {
+            writeDiagnostic("enseash: %s: here-documents cannot be compiled, the script runs from the source\n", path);
+            exit(EXIT_FAILURE);
+        }
+        line = *lineEnd != '\0' ? lineEnd + 1 : lineEnd;
+    }
+
+    CompiledHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_VERSION;
+    header.sourceHash = hashBytes(script, length);
+    header.sourceSize = (uint64_t) sourceInfo.st_size;
+    header.sourceModified = (int64_t) sourceInfo.st_mtim.tv_sec * 1000000000LL + sourceInfo.st_mtim.tv_nsec;
+
+    // Parse each statement once, with the same rules as the shell
+    ByteBuffer elements = { 0 }, stages = { 0 }, words = { 0 }, strings = { 0 };
+    appendBytes(&strings, "", 1);
+    size_t precompiled = 0;
+    char *cursor = script;
+    char *statement;
+    while ((statement = nextStatement(script, &cursor)) != NULL) {
+        ListElement list[MAX_LIST_ELEMENTS];
+        size_t listCount;
+        if (parseCommandList(statement, list, &listCount) == -1) {
+            writeDiagnostic("enseash: %s: the script cannot be compiled\n", path);
+            exit(2);
+        }
+        for (size_t i = 0; i < listCount; i++) {
+            CompiledElement element;
+            element.operator = (uint8_t) list[i].operator;
+            precompiled += (size_t) compileElement(list[i].command, &element, &stages, &words, &strings);
+            appendBytes(&elements, &element, sizeof(element));
+        }
+    }
+    header.elementCount = (uint32_t) (elements.length / sizeof(CompiledElement));
+    header.stageCount = (uint32_t) (stages.length / sizeof(CompiledStage));
+    header.wordCount = (uint32_t) (words.length / sizeof(uint32_t));
+    header.stringsLength = (uint32_t) strings.length;
+
+    // Write a temporary file, then rename it over the previous compiled script
+    char compiledPath[4096], temporary[4200];
+    snprintf(compiledPath, sizeof(compiledPath), "%s%s", path, COMPILED_SUFFIX);
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", compiledPath, (int) getpid());
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        fatalError("Error: compileScript\nopen");
+    }
+    struct iovec iov[5] = {
+        { &header, sizeof(header) },
+        { elements.data, elements.length },
+        { stages.data, stages.length },
+        { words.data, words.length },
+        { strings.data, strings.length },
+    };
+    size_t total = sizeof(header) + elements.length + stages.length + words.length + strings.length;
+    if (writev(fd, iov, 5) != (ssize_t) total || close(fd) == -1 || rename(temporary, compiledPath) == -1) {
+        unlink(temporary);
+        fatalError("Error: compileScript\nwritev");
+    }
+    writeFormattedMessage("%s: %u commands (%zu precompiled, %zu from source) -> %s (%zu bytes)\n", path,
+                          header.elementCount, precompiled, header.elementCount - precompiled, compiledPath, total);
+
+    free(elements.data);
+    free(stages.data);
+    free(words.data);
+    free(strings.data);
+    free(script);
+    exit(EXIT_SUCCESS);
+}
+
+const CompiledHeader *loadCompiledScript(const char *compiledPath, const char *path, const struct stat *sourceInfo,
+                                         char **script, size_t *length, size_t *size) {
+    int fd = open(compiledPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t) info.st_size < sizeof(CompiledHeader)) {
+        close(fd);
+        return NULL;
+    }
+    *size = (size_t) info.st_size;
+    const CompiledHeader *image = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    // A corrupted file, or one of another layout, is never executed
+    int valid = checkCompiledScript(image, *size);
+
+    // Fresh when the source has the same size and modification time, or else the same content
+    int64_t modified = (int64_t) sourceInfo->st_mtim.tv_sec * 1000000000LL + sourceInfo->st_mtim.tv_nsec;
+    if (valid && (image->sourceSize != (uint64_t) sourceInfo->st_size || image->sourceModified != modified)) {
+        *script = readScript(path, length);
+        valid = *script != NULL && hashBytes(*script, *length) == image->sourceHash;
+    }
+    if (!valid) {
+        writeDiagnostic("enseash: %s is stale, running the source\n", compiledPath);
+        munmap((void *) image, *size);
+        return NULL;
+    }
+    return image;
+}
+
+int checkCompiledScript(const CompiledHeader *image, size_t size) {
+    // The sections must fill the file exactly, and the strings must end with a null byte
+    size_t expected = compiledStrings(image) + image->stringsLength;
+    if (memcmp(image->magic, COMPILED_MAGIC, sizeof(image->magic)) != 0 || image->version != COMPILED_VERSION ||
+        expected != size || image->stringsLength == 0 || ((const char *) image)[size - 1] != '\0') {
+        return 0;
+    }
+
+    // Every offset must stay in its section: strings are then terminated by the last null byte
+    const CompiledElement *elements = (const CompiledElement *) (image + 1);
+    const CompiledStage *stages = (const CompiledStage *) (elements + image->elementCount);
+    const uint32_t *words = (const uint32_t *) (stages + image->stageCount);
+    for (uint32_t i = 0; i < image->elementCount; i++) {
+        const CompiledElement *element = &elements[i];
+        if (element->operator > LIST_OR || element->text >= image->stringsLength ||
+            element->inputFile >= image->stringsLength || element->outputFile >= image->stringsLength) {
+            return 0;
+        }
+        if (element->precompiled &&
+            (element->stageCount == 0 || (uint64_t) element->firstStage + element->stageCount > image->stageCount)) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < image->stageCount; i++) {
+        if (stages[i].wordCount == 0 || (uint64_t) stages[i].firstWord + stages[i].wordCount > image->wordCount) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < image->wordCount; i++) {
+        if (words[i] >= image->stringsLength) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void runCompiledScript(const CompiledHeader *image) {
+    const CompiledElement *elements = (const CompiledElement *) (image + 1);
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+
+    for (uint32_t i = 0; i < image->elementCount; i++) {
+        // '&&' and '||' decide from the status of the last command that ran
+        int succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if ((elements[i].operator == LIST_AND && !succeeded) || (elements[i].operator == LIST_OR && succeeded)) {
+            continue;
+        }
+
+        // Commands kept as source text go through the usual path
+        const char *text = (const char *) image + compiledStrings(image) + elements[i].text;
+        if (!elements[i].precompiled) {
+            char *command = strdup(text);
+            if (command == NULL) {
+                fatalError("Error: runCompiledScript\nstrdup");
+            }
+            executeListElement(command, &status, 0);
+            free(command);
+            continue;
+        }
+
+        // Precompiled command: fork and execute the argument tables
+        struct timespec start_time, end_time;
+        if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0) {
+            fatalError("Error: runCompiledScript (Start Time)\nclock_gettime");
+        }
+        pid_t pid = startProcess();
+        if (pid == 0) {
+            runCompiledCommand(image, &elements[i]);
+        }
+        waitCommand(pid, &status);
+        if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0) {
+            fatalError("Error: runCompiledScript (End Time)\nclock_gettime");
+        }
+        recordCommandStats(text, status, elapsedMicroseconds(&start_time, &end_time));
+    }
+    exit(EXIT_CODE(status));
+}
+
+size_t compiledStrings(const CompiledHeader *image) {
+    // Offset of the strings section from the start of the file
+    return sizeof(CompiledHeader) + (size_t) image->elementCount * sizeof(CompiledElement) +
+           (size_t) image->stageCount * sizeof(CompiledStage) + (size_t) image->wordCount * sizeof(uint32_t);
+}
+
+void runCompiledCommand(const CompiledHeader *image, const CompiledElement *element) {
+    const CompiledStage *stages = (const CompiledStage *) ((const CompiledElement *) (image + 1) + image->elementCount);
+    const uint32_t *words = (const uint32_t *) (stages + image->stageCount);
+    const char *strings = (const char *) image + compiledStrings(image);
+
+    // Input redirection of the first stage, output redirection of the last one
+    if (element->inputFile != COMPILED_NONE) {
+        int fd = open(strings + element->inputFile, O_RDONLY);
+        if (fd == -1 || dup2(fd, STDIN_FILENO) == -1) {
+            perror("Error: runCompiledCommand (Input)\nopen");
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+    }
+
+    for (uint16_t i = 0; i < element->stageCount; i++) {
+        const CompiledStage *stage = &stages[element->firstStage + i];
+        int last = i == element->stageCount - 1;
+
+        // Pipe to the next stage, which runs in this process after the fork
+        int pipefd[2];
+        pid_t pid = 0;
+        if (!last) {
+            if (pipe(pipefd) == -1) {
+                fatalError("Error: runCompiledCommand\npipe");
+            }
+            pid = fork();
+            if (pid == -1) {
+                fatalError("Error: runCompiledCommand\nfork");
+            }
+        }
+        if (pid != 0) {
+            if (dup2(pipefd[0], STDIN_FILENO) == -1) {
+                fatalError("Error: runCompiledCommand\ndup2");
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+            continue;
+        }
+        if (!last) {
+            if (dup2(pipefd[1], STDOUT_FILENO) == -1) {
+                fatalError("Error: runCompiledCommand\ndup2");
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+        } else if (element->outputFile != COMPILED_NONE) {
+            int fd = open(strings + element->outputFile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+            if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) {
+                perror("Error: runCompiledCommand (Output)\nopen");
+                exit(EXIT_FAILURE);
+            }
+            close(fd);
+        }
+
+        // Arguments of the stage, pointing into the mapped file
+        char *args[MAX_ARGS + 1];
+        for (uint32_t j = 0; j < stage->wordCount && j < MAX_ARGS; j++) {
+            args[j] = (char *) strings + words[stage->firstWord + j];
+        }
+        args[stage->wordCount < MAX_ARGS ? stage->wordCount : MAX_ARGS] = NULL;
+        char **command = args;
+        applyScheduling(&command);
+        execvp(command[0], command);
+        fatalError("Error: runCompiledCommand\nexecvp");
+    }
+    exit(EXIT_FAILURE);
+}
+
+
+
+// --------------------- Command String Mode --------------------- //
+void runCommandString(char *input) {
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+
+    // Execute the list: an external last command replaces the shell, otherwise its status is the exit code
+    // (unless the shell publishes metrics, as it has to wait for the last command)
+    executeCommandList(input, &status, metricsRing == NULL || getpid() != metricsOwner);
+    exit(EXIT_CODE(status));
+}
+
+
+
+// --------------------- Display Status --------------------- //
+void displayPromptStatus(int status, long executionTime) {
+    // Check if the command was successful
+    if (WIFEXITED(status)) {
+        // If the command exited normally, display exit status in the prompt
+        writeStatusMessage("exit", WEXITSTATUS(status), executionTime);
+    } else if (WIFSIGNALED(status)) {
+        // If the command was terminated by a signal, display signal information in the prompt
+        writeStatusMessage("sign", WTERMSIG(status), executionTime);
+    }
+}
+
+
+
+// --------------------- Main --------------------- //
+int main(int argc, char *argv[]) {
+    // Flush pending output whenever the shell exits
+    atexit(flushOutput);
+
+    // Dump the latency statistics on exit (registered after flushOutput, so it runs before it)
+    statsOwner = getpid();
+    atexit(dumpStats);
+
+    // Publish the completed commands in shared memory
+    openMetricsRing();
+
+    // Command string mode: run the command without welcome message or prompt
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            writeDiagnostic("enseash: -c: option requires an argument\n");
+            exit(2);
+        }
+        interactiveMode = 0;
+        if (collectHereDocuments(argv[2]) == -1) {
+            exit(2);
+        }
+        runCommandString(argv[2]);
+    }
+
+    // Compile a script into its precompiled form
+    if (argc > 1 && strcmp(argv[1], "--compile") == 0) {
+        if (argc != 3) {
+            writeDiagnostic("usage: enseash --compile SCRIPT\n");
+            exit(2);
+        }
+        interactiveMode = 0;
+        compileScript(argv[2]);
+    }
+
+    // Script mode: run the commands of a file (its compiled form when it is up to date)
+    if (argc > 1 && argv[1][0] != '-') {
+        interactiveMode = 0;
+        runScript(argv[1]);
+    }
+
+    // Replay mode: run a recorded session and compare its latencies
+    if (argc > 1 && strcmp(argv[1], "--replay") == 0) {
+        int fast = 0;
+        double threshold = 20.0;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--fast") == 0) {
+                fast = 1;
+            } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+                threshold = strtod(argv[++i], NULL);
+            } else {
+                argc = 0;
+            }
+        }
+        if (argc < 3) {
+            writeDiagnostic("usage: enseash --replay FILE [--fast] [--threshold PCT]\n");
+            exit(2);
+        }
+        interactiveMode = 0;
+        replaySession(argv[2], fast, threshold);
+    }
+
+    // Record mode: log each line of the interactive session
+    if (argc > 1 && strcmp(argv[1], "--record") == 0) {
+        if (argc < 3) {
+            writeDiagnostic("usage: enseash --record FILE\n");
+            exit(2);
+        }
+        openSessionRecord(argv[2]);
+    }
+
+    char input[MAX_INPUT_SIZE];
+    int status = EXIT_STATUS(EXIT_SUCCESS);
+    long executionTime;
+
+    // Display the welcome message at launch
+    writeMessage("Welcome to ENSEA Shell.\nType 'exit' or press 'Ctrl+D' to quit.\n");
+
+    // Display the shell prompt
+    writeMessage("enseash % ");
+
+    // Main loop
+    while (1) {
+        // Read user input
+        ssize_t bytesRead = readPrompt(input, sizeof(input));
+
+        // Process user input and execute the command
+        processUserInput(input, bytesRead, &status, &executionTime);
+
+        // Display prompt status
+        displayPromptStatus(status, executionTime);
+    }
+
+    exit(EXIT_SUCCESS);
+}